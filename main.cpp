@@ -1,7 +1,73 @@
+#include <csignal>
+#include <cstdlib>
 #include <iostream>
+#include <string>
 
+#include "src/server.hpp"
 #include "src/tree.hpp"
 
-int main() {
-  std::cout << "The factorial of 5 is " << std::endl;
+namespace {
+
+TreeMapServer* activeServer = nullptr;
+
+void handleSignal(int) {
+    if (activeServer)
+        activeServer->stop();
+}
+
+void usage(const char* argv0) {
+    std::cerr << "usage: " << argv0 << " [--port N] [--host ADDR] [--unix PATH]\n"
+              << "Serves a TreeMap over TCP (default 127.0.0.1:6380) and/or a Unix socket.\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string host = "127.0.0.1";
+    int port = -1;
+    std::string unixPath;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--port" && i + 1 < argc) {
+            port = std::atoi(argv[++i]);
+        } else if (arg == "--host" && i + 1 < argc) {
+            host = argv[++i];
+        } else if (arg == "--unix" && i + 1 < argc) {
+            unixPath = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (port < 0 && unixPath.empty())
+        port = 6380;
+
+    TreeMap map;
+    try {
+        TreeMapServer server(map);
+        if (port >= 0) {
+            std::uint16_t bound = server.listenTcp(static_cast<std::uint16_t>(port), host);
+            std::cout << "listening on " << host << ":" << bound << std::endl;
+        }
+        if (!unixPath.empty()) {
+            server.listenUnix(unixPath);
+            std::cout << "listening on " << unixPath << std::endl;
+        }
+
+        activeServer = &server;
+        std::signal(SIGINT, handleSignal);
+        std::signal(SIGTERM, handleSignal);
+
+        server.run();
+        activeServer = nullptr;
+
+        const auto& stats = server.stats();
+        std::cout << "served " << stats.commands << " commands in " << stats.batches
+                  << " batches (largest " << stats.largestBatch << ")" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
 }
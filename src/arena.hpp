@@ -0,0 +1,258 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+// =======================
+// ArenaMode
+// =======================
+
+// How SplayTree allocates its nodes.
+//   Heap      - one new/delete per node (original behaviour)
+//   Pooled    - fixed-size slots carved out of 2 MB chunks
+//   HugePages - like Pooled, but chunks are backed by huge pages when the
+//               kernel allows it (MAP_HUGETLB, then THP via madvise)
+enum class ArenaMode {
+    Heap,
+    Pooled,
+    HugePages
+};
+
+// =======================
+// NodeArena
+// =======================
+
+class NodeArena {
+public:
+    static constexpr std::size_t kChunkSize = 2 * 1024 * 1024;
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    NodeArena(std::size_t slotSize, std::size_t slotAlign, bool hugePages)
+        : slotBytes(roundUp(slotSize, slotAlign)),
+          perChunk(kChunkSize / slotBytes),
+          wantHugePages(hugePages) {}
+
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+
+    ~NodeArena() {
+        for (const Chunk& c : chunks)
+            releaseChunk(c);
+    }
+
+    // Hand out the lowest free slot (oldest chunk first), so live nodes
+    // stay packed towards the front and trailing chunks can drain
+    void* allocate() {
+        while (firstOpen < chunks.size() && chunks[firstOpen].live == perChunk)
+            ++firstOpen;
+        if (firstOpen == chunks.size())
+            addChunk();
+        Chunk& c = chunks[firstOpen];
+        while (c.used[c.hint] == ~std::uint64_t(0))
+            ++c.hint;
+        std::size_t slot = c.hint * 64 + static_cast<std::size_t>(std::countr_one(c.used[c.hint]));
+        return take(firstOpen, slot);
+    }
+
+    void deallocate(void* p) {
+        auto [ci, slot] = locate(p);
+        Chunk& c = chunks[ci];
+        c.used[slot / 64] &= ~(std::uint64_t(1) << (slot % 64));
+        c.hint = std::min(c.hint, slot / 64);
+        firstOpen = std::min(firstOpen, ci);
+        --c.live;
+        --liveSlots;
+    }
+
+    // ---- slot ordinals ----
+    // Slots are numbered chunk by chunk in creation order. Numbers stay
+    // stable until releaseEmptyChunks(); compaction uses them as targets.
+
+    std::size_t slotCount() const { return chunks.size() * perChunk; }
+
+    std::size_t slotIndex(const void* p) const {
+        auto [ci, slot] = locate(p);
+        return ci * perChunk + slot;
+    }
+
+    void* slotAddress(std::size_t index) const {
+        return static_cast<char*>(chunks[index / perChunk].base) + index % perChunk * slotBytes;
+    }
+
+    bool slotLive(std::size_t index) const {
+        std::size_t slot = index % perChunk;
+        return chunks[index / perChunk].used[slot / 64] >> (slot % 64) & 1;
+    }
+
+    // Claim a specific slot, which must be free
+    void* allocateAt(std::size_t index) {
+        return take(index / perChunk, index % perChunk);
+    }
+
+    // Give chunks with no live slot back to the system
+    void releaseEmptyChunks() {
+        std::size_t kept = 0;
+        for (std::size_t i = 0; i < chunks.size(); ++i) {
+            if (chunks[i].live == 0)
+                releaseChunk(chunks[i]);
+            else if (kept++ != i)
+                chunks[kept - 1] = std::move(chunks[i]);
+        }
+        chunks.resize(kept);
+        firstOpen = 0;
+        indexChunks();
+    }
+
+    std::size_t slotSize() const { return slotBytes; }
+    std::size_t slotsInUse() const { return liveSlots; }
+    std::size_t chunkCount() const { return chunks.size(); }
+    std::size_t bytesReserved() const { return chunks.size() * kChunkSize; }
+
+    // Memory the arena uses to track its chunks
+    std::size_t bookkeepingBytes() const {
+        std::size_t bytes = sizeof(NodeArena) + chunks.capacity() * sizeof(Chunk) +
+                            byAddress.capacity() * sizeof(byAddress[0]);
+        for (const Chunk& c : chunks)
+            bytes += c.used.capacity() * sizeof(std::uint64_t);
+        return bytes;
+    }
+
+    // Chunks the kernel backed with explicit (MAP_HUGETLB) huge pages
+    std::size_t hugetlbChunks() const {
+        std::size_t n = 0;
+        for (const Chunk& c : chunks)
+            n += c.kind == ChunkKind::Hugetlb;
+        return n;
+    }
+
+    // Chunks that were advised for transparent huge pages
+    std::size_t transparentHugeChunks() const {
+        std::size_t n = 0;
+        for (const Chunk& c : chunks)
+            n += c.kind == ChunkKind::Transparent;
+        return n;
+    }
+
+private:
+    enum class ChunkKind { Heap, Mapped, Transparent, Hugetlb };
+
+    struct Chunk {
+        void* base;
+        void* mapping;      // what to hand back to munmap/delete
+        std::size_t mappedBytes;
+        ChunkKind kind;
+        std::vector<std::uint64_t> used;   // one bit per slot
+        std::size_t live = 0;
+        std::size_t hint = 0;              // no free slot in words before this
+    };
+
+    std::size_t slotBytes;
+    std::size_t perChunk;
+    bool wantHugePages;
+
+    std::vector<Chunk> chunks;
+    std::vector<std::pair<const char*, std::size_t>> byAddress;   // sorted chunk bases
+    std::size_t firstOpen = 0;    // no chunk before this has a free slot
+    std::size_t liveSlots = 0;
+
+    static std::size_t roundUp(std::size_t n, std::size_t align) {
+        return (n + align - 1) / align * align;
+    }
+
+    void* take(std::size_t ci, std::size_t slot) {
+        Chunk& c = chunks[ci];
+        c.used[slot / 64] |= std::uint64_t(1) << (slot % 64);
+        ++c.live;
+        ++liveSlots;
+        return static_cast<char*>(c.base) + slot * slotBytes;
+    }
+
+    // (chunk number, slot within it) of an address handed out earlier
+    std::pair<std::size_t, std::size_t> locate(const void* p) const {
+        const char* addr = static_cast<const char*>(p);
+        auto it = std::upper_bound(byAddress.begin(), byAddress.end(), addr,
+                                   [](const char* a, const auto& entry) { return a < entry.first; });
+        --it;
+        return {it->second, static_cast<std::size_t>(addr - it->first) / slotBytes};
+    }
+
+    void addChunk() {
+        Chunk c = wantHugePages ? mapHugeChunk() : heapChunk();
+        c.used.assign((perChunk + 63) / 64, 0);
+        if (perChunk % 64)
+            c.used.back() = ~std::uint64_t(0) << (perChunk % 64);   // past the end: never free
+        chunks.push_back(std::move(c));
+        indexChunks();
+    }
+
+    void indexChunks() {
+        byAddress.clear();
+        for (std::size_t i = 0; i < chunks.size(); ++i)
+            byAddress.emplace_back(static_cast<const char*>(chunks[i].base), i);
+        std::sort(byAddress.begin(), byAddress.end());
+    }
+
+    static Chunk heapChunk() {
+        void* p = ::operator new(kChunkSize, std::align_val_t{alignof(std::max_align_t)});
+        return Chunk{p, p, kChunkSize, ChunkKind::Heap, {}};
+    }
+
+    // Try explicit huge pages, then a 2 MB aligned mapping with THP advice,
+    // then plain heap memory.
+    static Chunk mapHugeChunk() {
+#if defined(__linux__) && defined(MAP_HUGETLB)
+        void* p = mmap(nullptr, kChunkSize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+            return Chunk{p, p, kChunkSize, ChunkKind::Hugetlb, {}};
+#endif
+#if defined(__linux__)
+        // Over-map so the chunk can start on a 2 MB boundary; THP only
+        // backs aligned ranges.
+        std::size_t span = kChunkSize * 2;
+        void* raw = mmap(nullptr, span, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw != MAP_FAILED) {
+            char* base = static_cast<char*>(raw);
+            char* aligned = reinterpret_cast<char*>(
+                roundUp(reinterpret_cast<std::size_t>(base), kChunkSize));
+            std::size_t head = static_cast<std::size_t>(aligned - base);
+            if (head)
+                munmap(base, head);
+            std::size_t tail = span - head - kChunkSize;
+            if (tail)
+                munmap(aligned + kChunkSize, tail);
+
+            ChunkKind kind = ChunkKind::Mapped;
+#if defined(MADV_HUGEPAGE)
+            if (madvise(aligned, kChunkSize, MADV_HUGEPAGE) == 0)
+                kind = ChunkKind::Transparent;
+#endif
+            return Chunk{aligned, aligned, kChunkSize, kind, {}};
+        }
+#endif
+        return heapChunk();
+    }
+
+    static void releaseChunk(const Chunk& c) {
+        if (c.kind == ChunkKind::Heap) {
+            ::operator delete(c.mapping, std::align_val_t{alignof(std::max_align_t)});
+            return;
+        }
+#if defined(__linux__)
+        munmap(c.mapping, c.mappedBytes);
+#endif
+    }
+};
+
+#endif // ARENA_HPP
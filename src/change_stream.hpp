@@ -0,0 +1,167 @@
+#ifndef CHANGE_STREAM_HPP
+#define CHANGE_STREAM_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// =======================
+// MutationEvent
+// =======================
+
+enum class MutationType : std::uint8_t {
+    Insert,   // insert or overwrite
+    Delete,
+    Clear     // every entry removed; no key or value
+};
+
+struct MutationEvent {
+    std::uint64_t sequence = 0;
+    MutationType type = MutationType::Insert;
+    std::string key;
+    std::string value;    // empty for Delete and Clear
+};
+
+// =======================
+// ChangeSubscription
+// =======================
+
+// Lock-free single-producer/single-consumer ring of mutation events. The
+// map's thread pushes; one consumer thread drains in batches. When the
+// ring is full new events are dropped and the subscription is marked as
+// overflowed, so the consumer knows to resynchronise (sequence numbers
+// also show exactly where the gap is).
+class ChangeSubscription {
+public:
+    explicit ChangeSubscription(std::size_t capacity) {
+        std::size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    ChangeSubscription(const ChangeSubscription&) = delete;
+    ChangeSubscription& operator=(const ChangeSubscription&) = delete;
+
+    // Producer side
+    bool tryPush(MutationEvent&& event) {
+        std::size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) > mask) {
+            droppedCount.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        slots[t & mask] = std::move(event);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side: move up to max events into out; returns how many
+    std::size_t readBatch(std::vector<MutationEvent>& out, std::size_t max) {
+        std::size_t h = head.load(std::memory_order_relaxed);
+        std::size_t available = tail.load(std::memory_order_acquire) - h;
+        std::size_t n = available < max ? available : max;
+
+        for (std::size_t i = 0; i < n; ++i)
+            out.push_back(std::move(slots[(h + i) & mask]));
+        head.store(h + n, std::memory_order_release);
+        return n;
+    }
+
+    std::size_t pending() const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    bool overflowed() const {
+        return droppedCount.load(std::memory_order_relaxed) != 0;
+    }
+
+    std::uint64_t dropped() const {
+        return droppedCount.load(std::memory_order_relaxed);
+    }
+
+    // Either side may cancel; the producer forgets the subscription on
+    // its next publish. Dropping every consumer handle does the same.
+    void cancel() {
+        closed.store(true, std::memory_order_release);
+    }
+
+    bool cancelled() const {
+        return closed.load(std::memory_order_acquire);
+    }
+
+private:
+    std::vector<MutationEvent> slots;
+    std::size_t mask = 0;
+
+    alignas(64) std::atomic<std::size_t> head{0};   // next slot to read
+    alignas(64) std::atomic<std::size_t> tail{0};   // next slot to write
+    alignas(64) std::atomic<std::uint64_t> droppedCount{0};
+    std::atomic<bool> closed{false};
+};
+
+// =======================
+// ChangeStream
+// =======================
+
+// Fans mutations out to subscribers. Used from the thread that owns the
+// map; with no subscribers publishing only bumps the sequence number.
+// A subscription nobody else holds any more is dropped like a cancelled
+// one: no other thread can take a new reference to it, so use_count()
+// reading 1 here is final.
+class ChangeStream {
+public:
+    std::shared_ptr<ChangeSubscription> subscribe(std::size_t capacity) {
+        auto sub = std::make_shared<ChangeSubscription>(capacity);
+        subscribers.push_back(sub);
+        return sub;
+    }
+
+    std::uint64_t publish(MutationType type, std::string_view key, std::string_view value) {
+        std::uint64_t seq = ++lastSeq;
+        if (subscribers.empty()) return seq;
+
+        bool anyGone = false;
+        for (const auto& sub : subscribers) {
+            if (gone(sub)) {
+                anyGone = true;
+                continue;
+            }
+            MutationEvent event;
+            event.sequence = seq;
+            event.type = type;
+            event.key.assign(key);
+            event.value.assign(value);
+            sub->tryPush(std::move(event));
+        }
+
+        if (anyGone) {
+            std::erase_if(subscribers, gone);
+        }
+        return seq;
+    }
+
+    std::uint64_t lastSequence() const {
+        return lastSeq;
+    }
+
+    bool hasSubscribers() const {
+        return !subscribers.empty();
+    }
+
+private:
+    std::uint64_t lastSeq = 0;
+
+    static bool gone(const std::shared_ptr<ChangeSubscription>& sub) {
+        return sub.use_count() == 1 || sub->cancelled();
+    }
+
+    std::vector<std::shared_ptr<ChangeSubscription>> subscribers;
+};
+
+#endif // CHANGE_STREAM_HPP
@@ -0,0 +1,295 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "tree.hpp"
+
+// =======================
+// Checkpoint file format
+// =======================
+
+//   "TMCKPT1\n"
+//   (u32 keyLen, u32 valueLen, key, value)*   in key order
+//   u32 0xFFFFFFFF, u64 entryCount            trailer
+// Integers are little endian, so keys and values must be under 4 GiB.
+// The file is written to "<path>.tmp" and renamed into place, so a
+// crashed checkpoint never replaces a good one.
+
+struct CheckpointStats {
+    std::uint64_t entries = 0;
+    std::uint64_t bytes = 0;
+    double seconds = 0;
+    double pauseMicros = 0;   // time the caller was blocked (fork)
+
+    double bytesPerSecond() const {
+        return seconds > 0 ? static_cast<double>(bytes) / seconds : 0;
+    }
+};
+
+namespace checkpoint_detail {
+
+constexpr char kMagic[] = "TMCKPT1\n";
+constexpr std::size_t kMagicSize = sizeof(kMagic) - 1;
+constexpr std::uint32_t kTrailer = 0xFFFFFFFFu;
+
+inline void putU32(std::FILE* f, std::uint32_t v) {
+    unsigned char b[4];
+    for (int i = 0; i < 4; ++i)
+        b[i] = static_cast<unsigned char>(v >> (8 * i));
+    std::fwrite(b, 1, 4, f);
+}
+
+inline void putU64(std::FILE* f, std::uint64_t v) {
+    unsigned char b[8];
+    for (int i = 0; i < 8; ++i)
+        b[i] = static_cast<unsigned char>(v >> (8 * i));
+    std::fwrite(b, 1, 8, f);
+}
+
+inline bool getU32(std::FILE* f, std::uint32_t& v) {
+    unsigned char b[4];
+    if (std::fread(b, 1, 4, f) != 4) return false;
+    v = 0;
+    for (int i = 0; i < 4; ++i)
+        v |= static_cast<std::uint32_t>(b[i]) << (8 * i);
+    return true;
+}
+
+inline bool getU64(std::FILE* f, std::uint64_t& v) {
+    unsigned char b[8];
+    if (std::fread(b, 1, 8, f) != 8) return false;
+    v = 0;
+    for (int i = 0; i < 8; ++i)
+        v |= static_cast<std::uint64_t>(b[i]) << (8 * i);
+    return true;
+}
+
+} // namespace checkpoint_detail
+
+// Write every entry of `map` to `path` in key order, synchronously
+inline CheckpointStats writeCheckpoint(TreeMap& map, const std::string& path) {
+    using namespace checkpoint_detail;
+    auto start = std::chrono::steady_clock::now();
+
+    std::string tmp = path + ".tmp";
+    std::FILE* f = std::fopen(tmp.c_str(), "wb");
+    if (!f)
+        throw std::runtime_error("checkpoint: cannot create " + tmp + ": " + std::strerror(errno));
+    std::setvbuf(f, nullptr, _IOFBF, 1 << 20);
+
+    CheckpointStats stats;
+    std::fwrite(kMagic, 1, kMagicSize, f);
+    stats.bytes += kMagicSize;
+
+    // kTrailer doubles as the end marker, so it is not a valid length either
+    bool tooLarge = false;
+    map.scan("", [&](const std::string& key, const std::string& value) {
+        if (key.size() >= kTrailer || value.size() >= kTrailer) {
+            tooLarge = true;
+            return false;
+        }
+        putU32(f, static_cast<std::uint32_t>(key.size()));
+        putU32(f, static_cast<std::uint32_t>(value.size()));
+        std::fwrite(key.data(), 1, key.size(), f);
+        std::fwrite(value.data(), 1, value.size(), f);
+        stats.bytes += 8 + key.size() + value.size();
+        ++stats.entries;
+        return !std::ferror(f); // stop at the first failed write
+    });
+
+    putU32(f, kTrailer);
+    putU64(f, stats.entries);
+    stats.bytes += 12;
+
+    // fwrite failures only show up in the stream's error flag
+    bool ok = !tooLarge && !std::ferror(f) && std::fflush(f) == 0 && ::fsync(::fileno(f)) == 0;
+    ok = std::fclose(f) == 0 && ok;
+    if (tooLarge) {
+        std::remove(tmp.c_str());
+        throw std::runtime_error("checkpoint: an entry of 4 GiB or more cannot be written to " + path);
+    }
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        throw std::runtime_error("checkpoint: failed writing " + path);
+    }
+
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+// Replace the contents of `map` with a checkpoint; returns entries loaded.
+// Throws std::runtime_error if the file is missing, truncated or corrupt,
+// leaving `map` untouched: the file is read into a scratch map first.
+inline std::uint64_t loadCheckpoint(TreeMap& map, const std::string& path) {
+    using namespace checkpoint_detail;
+    std::FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f)
+        throw std::runtime_error("checkpoint: cannot open " + path);
+
+    // Lengths are checked against what is left of the file before any
+    // buffer is sized from them
+    struct stat st{};
+    std::uint64_t remaining = ::fstat(::fileno(f), &st) == 0 ? static_cast<std::uint64_t>(st.st_size) : 0;
+
+    char magic[kMagicSize];
+    bool ok = std::fread(magic, 1, kMagicSize, f) == kMagicSize &&
+              std::memcmp(magic, kMagic, kMagicSize) == 0;
+    remaining -= ok ? kMagicSize : 0;
+
+    TreeMap staged;
+    std::uint64_t loaded = 0;
+    std::string key, value;
+    while (ok) {
+        std::uint32_t keyLen = 0, valueLen = 0;
+        if (!getU32(f, keyLen)) {
+            ok = false;
+            break;
+        }
+        if (keyLen == kTrailer) {
+            std::uint64_t expected = 0;
+            ok = getU64(f, expected) && expected == loaded;
+            break;
+        }
+        if (!getU32(f, valueLen) || remaining < 8 || remaining - 8 < std::uint64_t{keyLen} + valueLen) {
+            ok = false;
+            break;
+        }
+        remaining -= 8 + std::uint64_t{keyLen} + valueLen;
+        key.resize(keyLen);
+        value.resize(valueLen);
+        if (std::fread(key.data(), 1, keyLen, f) != keyLen ||
+            std::fread(value.data(), 1, valueLen, f) != valueLen) {
+            ok = false;
+            break;
+        }
+        staged.insert(key, value);
+        ++loaded;
+    }
+    ok = !std::ferror(f) && ok;
+    std::fclose(f);
+
+    if (!ok)
+        throw std::runtime_error("checkpoint: " + path + " is truncated or corrupt");
+
+    // Copied rather than swapped so `map` keeps its own configuration and
+    // subscribers see the reload as a clear plus inserts
+    map.clear();
+    staged.scan("", [&](const std::string& k, const std::string& v) {
+        map.insert(k, v);
+        return true;
+    });
+    return loaded;
+}
+
+// =======================
+// BackgroundCheckpoint
+// =======================
+
+// Checkpoint without stopping writers: fork() gives a child process a
+// copy-on-write image of the map, which it walks in order and writes out
+// while the parent keeps mutating its own pages. The caller is blocked
+// only for the fork itself (reported as pauseMicros).
+//
+// Start it from the thread that owns the map. The child only touches the
+// map, so other threads of the parent must not hold the allocator lock
+// across the fork, as with any fork() in a threaded program.
+class BackgroundCheckpoint {
+public:
+    BackgroundCheckpoint(TreeMap& map, const std::string& path) {
+        int fds[2];
+        if (::pipe(fds) != 0)
+            throw std::runtime_error("checkpoint: pipe failed");
+
+        auto before = std::chrono::steady_clock::now();
+        pid = ::fork();
+        if (pid < 0) {
+            ::close(fds[0]);
+            ::close(fds[1]);
+            throw std::runtime_error("checkpoint: fork failed");
+        }
+
+        if (pid == 0) {
+            ::close(fds[0]);
+            int code = 0;
+            CheckpointStats stats;
+            try {
+                stats = writeCheckpoint(map, path);
+            } catch (...) {
+                code = 1;
+            }
+            [[maybe_unused]] ssize_t n = ::write(fds[1], &stats, sizeof(stats));
+            ::_exit(code);
+        }
+
+        pauseMicros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - before).count();
+        ::close(fds[1]);
+        statsFd = fds[0];
+    }
+
+    BackgroundCheckpoint(const BackgroundCheckpoint&) = delete;
+    BackgroundCheckpoint& operator=(const BackgroundCheckpoint&) = delete;
+
+    ~BackgroundCheckpoint() {
+        if (!finished) {
+            try {
+                wait();
+            } catch (...) {
+            }
+        }
+    }
+
+    // Non-blocking check
+    bool done() {
+        if (finished) return true;
+        int status = 0;
+        pid_t r = ::waitpid(pid, &status, WNOHANG);
+        if (r == pid) {
+            collect(status);
+            return true;
+        }
+        return false;
+    }
+
+    // Block until the child finishes; throws if the checkpoint failed
+    CheckpointStats wait() {
+        if (!finished) {
+            int status = 0;
+            while (::waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+            collect(status);
+        }
+        if (!succeeded)
+            throw std::runtime_error("checkpoint: background writer failed");
+        return result;
+    }
+
+private:
+    pid_t pid = -1;
+    int statsFd = -1;
+    double pauseMicros = 0;
+    bool finished = false;
+    bool succeeded = false;
+    CheckpointStats result;
+
+    void collect(int status) {
+        finished = true;
+        succeeded = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if (::read(statsFd, &result, sizeof(result)) != static_cast<ssize_t>(sizeof(result)))
+            succeeded = false;
+        ::close(statsFd);
+        result.pauseMicros = pauseMicros;
+    }
+};
+
+#endif // CHECKPOINT_HPP
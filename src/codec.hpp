@@ -0,0 +1,280 @@
+#ifndef CODEC_HPP
+#define CODEC_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// =======================
+// ValueCodec
+// =======================
+
+// Pluggable value compression used by TreeMap::setValueCodec
+class ValueCodec {
+public:
+    virtual ~ValueCodec() = default;
+
+    virtual std::string compress(std::string_view raw) const = 0;
+
+    // Throws std::runtime_error on malformed input
+    virtual std::string decompress(const std::string& packed) const = 0;
+};
+
+// =======================
+// LzCodec
+// =======================
+
+// Byte-oriented LZ77 in the style of LZ4: each sequence is a token
+// (literal length / match length nibbles), the literals, and a 16-bit
+// back-reference. An optional shared dictionary acts as history that
+// matches may point into, which is what makes short, similar values
+// (e.g. JSON documents with the same field names) compress well.
+class LzCodec : public ValueCodec {
+public:
+    static constexpr std::size_t kMaxDictionary = 64 * 1024;
+
+    LzCodec() = default;
+
+    explicit LzCodec(std::string dict)
+        : dictionary(std::move(dict)) {
+        if (dictionary.size() > kMaxDictionary)
+            dictionary.erase(0, dictionary.size() - kMaxDictionary);
+    }
+
+    // Build a dictionary from representative values. Samples are cut into
+    // segments, each scored by how many samples share its 8-byte substrings;
+    // the best segments are kept, most useful last (closest to the data).
+    static LzCodec train(const std::vector<std::string>& samples,
+                         std::size_t dictSize = 4096) {
+        constexpr std::size_t kGram = 8;
+        constexpr std::size_t kSegment = 32;
+
+        std::unordered_map<std::string, std::size_t> docFreq;
+        for (const std::string& sample : samples) {
+            std::unordered_map<std::string, bool> seen;
+            for (std::size_t i = 0; i + kGram <= sample.size(); ++i) {
+                std::string gram = sample.substr(i, kGram);
+                if (!seen[gram]) {
+                    seen[gram] = true;
+                    ++docFreq[gram];
+                }
+            }
+        }
+
+        struct Segment {
+            std::size_t score;
+            std::string bytes;
+        };
+        std::vector<Segment> segments;
+        for (const std::string& sample : samples) {
+            for (std::size_t pos = 0; pos < sample.size(); pos += kSegment) {
+                std::string bytes = sample.substr(pos, kSegment);
+                std::size_t score = 0;
+                for (std::size_t i = 0; i + kGram <= bytes.size(); ++i) {
+                    auto it = docFreq.find(bytes.substr(i, kGram));
+                    if (it != docFreq.end() && it->second > 1)
+                        score += it->second;
+                }
+                if (score)
+                    segments.push_back(Segment{score, std::move(bytes)});
+            }
+        }
+
+        std::stable_sort(segments.begin(), segments.end(),
+                         [](const Segment& a, const Segment& b) { return a.score > b.score; });
+
+        std::vector<std::string> picked;
+        std::size_t total = 0;
+        std::unordered_map<std::string, bool> used;
+        for (const Segment& seg : segments) {
+            if (total + seg.bytes.size() > dictSize) break;
+            if (used[seg.bytes]) continue;
+            used[seg.bytes] = true;
+            picked.push_back(seg.bytes);
+            total += seg.bytes.size();
+        }
+
+        std::string dict;
+        dict.reserve(total);
+        for (auto it = picked.rbegin(); it != picked.rend(); ++it)
+            dict += *it;
+        return LzCodec(std::move(dict));
+    }
+
+    const std::string& dictionaryBytes() const {
+        return dictionary;
+    }
+
+    std::string compress(std::string_view raw) const override {
+        std::string out;
+        out.reserve(raw.size() / 2 + 16);
+        putVarint(out, raw.size());
+
+        std::string buf;
+        const char* data = raw.data();
+        std::size_t start = 0;
+        if (!dictionary.empty()) {
+            buf.reserve(dictionary.size() + raw.size());
+            buf = dictionary;
+            buf += raw;
+            data = buf.data();
+            start = dictionary.size();
+        }
+        std::size_t end = start + raw.size();
+
+        std::vector<std::int32_t> table(kHashSize, -1);
+        for (std::size_t i = 0; i + kMinMatch <= start; ++i)
+            table[hash(data + i)] = static_cast<std::int32_t>(i);
+
+        std::size_t anchor = start;
+        std::size_t i = start;
+        while (i + kMinMatch <= end) {
+            std::uint32_t h = hash(data + i);
+            std::int32_t cand = table[h];
+            table[h] = static_cast<std::int32_t>(i);
+
+            if (cand >= 0 && i - static_cast<std::size_t>(cand) <= 0xFFFF &&
+                std::memcmp(data + cand, data + i, kMinMatch) == 0) {
+                std::size_t len = kMinMatch;
+                while (i + len < end && data[cand + len] == data[i + len])
+                    ++len;
+
+                emitSequence(out, data + anchor, i - anchor,
+                             i - static_cast<std::size_t>(cand), len);
+                i += len;
+                anchor = i;
+            } else {
+                ++i;
+            }
+        }
+
+        emitLiterals(out, data + anchor, end - anchor);
+        return out;
+    }
+
+    std::string decompress(const std::string& packed) const override {
+        std::size_t pos = 0;
+        std::size_t rawSize = getVarint(packed, pos);
+
+        std::string out;
+        out.reserve(dictionary.size() + rawSize);
+        out = dictionary;
+        std::size_t target = dictionary.size() + rawSize;
+
+        while (true) {
+            if (pos >= packed.size())
+                throw std::runtime_error("LzCodec: truncated input");
+            unsigned char token = static_cast<unsigned char>(packed[pos++]);
+
+            std::size_t litLen = readLength(packed, pos, token >> 4);
+            if (pos + litLen > packed.size() || out.size() + litLen > target)
+                throw std::runtime_error("LzCodec: literal overrun");
+            out.append(packed, pos, litLen);
+            pos += litLen;
+
+            if (out.size() == target) break;
+
+            if (pos + 2 > packed.size())
+                throw std::runtime_error("LzCodec: truncated offset");
+            std::size_t offset = static_cast<unsigned char>(packed[pos]) |
+                                 (static_cast<std::size_t>(static_cast<unsigned char>(packed[pos + 1])) << 8);
+            pos += 2;
+            std::size_t matchLen = readLength(packed, pos, token & 0x0F) + kMinMatch;
+
+            if (offset == 0 || offset > out.size() || out.size() + matchLen > target)
+                throw std::runtime_error("LzCodec: bad match");
+
+            // Byte at a time: matches may overlap their own output
+            std::size_t from = out.size() - offset;
+            for (std::size_t k = 0; k < matchLen; ++k)
+                out.push_back(out[from + k]);
+        }
+
+        return out.substr(dictionary.size());
+    }
+
+private:
+    static constexpr std::size_t kMinMatch = 4;
+    static constexpr std::size_t kHashBits = 12;
+    static constexpr std::size_t kHashSize = std::size_t{1} << kHashBits;
+
+    std::string dictionary;
+
+    static std::uint32_t hash(const char* p) {
+        std::uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return (v * 2654435761u) >> (32 - kHashBits);
+    }
+
+    static void putVarint(std::string& out, std::size_t v) {
+        while (v >= 0x80) {
+            out.push_back(static_cast<char>((v & 0x7F) | 0x80));
+            v >>= 7;
+        }
+        out.push_back(static_cast<char>(v));
+    }
+
+    static std::size_t getVarint(const std::string& in, std::size_t& pos) {
+        std::size_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (pos >= in.size())
+                throw std::runtime_error("LzCodec: truncated header");
+            unsigned char b = static_cast<unsigned char>(in[pos++]);
+            v |= static_cast<std::size_t>(b & 0x7F) << shift;
+            if (!(b & 0x80)) return v;
+        }
+        throw std::runtime_error("LzCodec: bad header");
+    }
+
+    // Nibble value 15 means "more length bytes follow", LZ4 style
+    static void putLengthTail(std::string& out, std::size_t len) {
+        if (len < 15) return;
+        len -= 15;
+        while (len >= 255) {
+            out.push_back(static_cast<char>(255));
+            len -= 255;
+        }
+        out.push_back(static_cast<char>(len));
+    }
+
+    static std::size_t readLength(const std::string& in, std::size_t& pos, std::size_t nibble) {
+        std::size_t len = nibble;
+        if (nibble < 15) return len;
+        while (true) {
+            if (pos >= in.size())
+                throw std::runtime_error("LzCodec: truncated length");
+            unsigned char b = static_cast<unsigned char>(in[pos++]);
+            len += b;
+            if (b != 255) return len;
+        }
+    }
+
+    static void emitSequence(std::string& out, const char* lit, std::size_t litLen,
+                             std::size_t offset, std::size_t matchLen) {
+        std::size_t m = matchLen - kMinMatch;
+        unsigned char token = static_cast<unsigned char>(
+            ((litLen < 15 ? litLen : 15) << 4) | (m < 15 ? m : 15));
+        out.push_back(static_cast<char>(token));
+        putLengthTail(out, litLen);
+        out.append(lit, litLen);
+        out.push_back(static_cast<char>(offset & 0xFF));
+        out.push_back(static_cast<char>(offset >> 8));
+        putLengthTail(out, m);
+    }
+
+    static void emitLiterals(std::string& out, const char* lit, std::size_t litLen) {
+        unsigned char token = static_cast<unsigned char>((litLen < 15 ? litLen : 15) << 4);
+        out.push_back(static_cast<char>(token));
+        putLengthTail(out, litLen);
+        out.append(lit, litLen);
+    }
+};
+
+#endif // CODEC_HPP
@@ -0,0 +1,132 @@
+#ifndef COLD_STORE_HPP
+#define COLD_STORE_HPP
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// =======================
+// ColdLocator
+// =======================
+
+// Where a spilled value lives inside a ColdStore file
+struct ColdLocator {
+    std::uint64_t offset = 0;
+    std::uint32_t length = 0;
+
+    static constexpr std::size_t kEncodedSize = 12;
+
+    // Fixed-width encoding, short enough to sit in a string's SSO buffer
+    std::string encode() const {
+        std::string out(kEncodedSize, '\0');
+        std::memcpy(&out[0], &offset, sizeof(offset));
+        std::memcpy(&out[sizeof(offset)], &length, sizeof(length));
+        return out;
+    }
+
+    static ColdLocator decode(const std::string& bytes) {
+        if (bytes.size() != kEncodedSize)
+            throw std::runtime_error("ColdLocator: bad encoding");
+        ColdLocator loc;
+        std::memcpy(&loc.offset, bytes.data(), sizeof(loc.offset));
+        std::memcpy(&loc.length, bytes.data() + sizeof(loc.offset), sizeof(loc.length));
+        return loc;
+    }
+};
+
+// =======================
+// ColdStore
+// =======================
+
+// Append-only file holding values spilled out of memory. Released space
+// is only counted here; the owner reclaims it by copying the live values
+// into a fresh store once wantsCompaction() says at least half the file
+// is dead. The file is removed when the store is destroyed.
+class ColdStore {
+public:
+    // Files smaller than this are never worth compacting
+    static constexpr std::uint64_t kCompactMinBytes = 64 * 1024;
+
+    explicit ColdStore(const std::string& filePath)
+        : path(filePath) {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0)
+            throw std::runtime_error("ColdStore: cannot open " + path + ": " + std::strerror(errno));
+    }
+
+    ColdStore(const ColdStore&) = delete;
+    ColdStore& operator=(const ColdStore&) = delete;
+
+    ~ColdStore() {
+        ::close(fd);
+        ::unlink(path.c_str());
+    }
+
+    ColdLocator put(const std::string& bytes) {
+        ColdLocator loc;
+        loc.offset = endOffset;
+        loc.length = static_cast<std::uint32_t>(bytes.size());
+
+        std::size_t done = 0;
+        while (done < bytes.size()) {
+            ssize_t n = ::pwrite(fd, bytes.data() + done, bytes.size() - done,
+                                 static_cast<off_t>(loc.offset + done));
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error("ColdStore: write failed: " + std::string(std::strerror(errno)));
+            }
+            done += static_cast<std::size_t>(n);
+        }
+
+        endOffset += bytes.size();
+        live += bytes.size();
+        return loc;
+    }
+
+    std::string get(const ColdLocator& loc) const {
+        std::string out(loc.length, '\0');
+        std::size_t done = 0;
+        while (done < out.size()) {
+            ssize_t n = ::pread(fd, &out[done], out.size() - done,
+                                static_cast<off_t>(loc.offset + done));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0)
+                throw std::runtime_error("ColdStore: read failed");
+            done += static_cast<std::size_t>(n);
+        }
+        return out;
+    }
+
+    void release(const ColdLocator& loc) {
+        live -= loc.length;
+    }
+
+    std::uint64_t liveBytes() const { return live; }
+    std::uint64_t fileBytes() const { return endOffset; }
+    const std::string& filePath() const { return path; }
+
+    bool wantsCompaction() const {
+        return endOffset >= kCompactMinBytes && live * 2 < endOffset;
+    }
+
+    // Move the file, replacing whatever is at newPath
+    void renameTo(const std::string& newPath) {
+        if (::rename(path.c_str(), newPath.c_str()) != 0)
+            throw std::runtime_error("ColdStore: cannot rename to " + newPath + ": " + std::strerror(errno));
+        path = newPath;
+    }
+
+private:
+    std::string path;
+    int fd = -1;
+    std::uint64_t endOffset = 0;
+    std::uint64_t live = 0;
+};
+
+#endif // COLD_STORE_HPP
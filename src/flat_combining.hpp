@@ -0,0 +1,223 @@
+#ifndef FLAT_COMBINING_HPP
+#define FLAT_COMBINING_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "tree.hpp"
+
+// =======================
+// FlatCombiningTreeMap
+// =======================
+
+struct FlatCombiningStats {
+    std::uint64_t batches = 0;       // combining passes that ran something
+    std::uint64_t operations = 0;
+    std::uint64_t largestBatch = 0;
+};
+
+// Concurrent front end for a TreeMap. Every lookup splays, so the map is
+// serial anyway; instead of queueing threads on a mutex, each thread
+// publishes its operation in a slot and spins, and whichever thread wins
+// the combiner flag runs every published operation in one pass. The tree
+// stays in one core's cache, and a batch can be sorted by key so
+// consecutive operations hit neighbouring, freshly splayed nodes.
+//
+// The wrapped map must not be touched directly while the wrapper is in
+// use. Operations from different threads in one batch are concurrent, so
+// any order is a valid one; a thread never has two operations pending.
+class FlatCombiningTreeMap {
+public:
+    // `slots` bounds how many threads can publish at once without probing
+    explicit FlatCombiningTreeMap(TreeMap& m, bool sortBatches = true,
+                                  std::size_t slots = 2 * std::max(1u, std::thread::hardware_concurrency()))
+        : map(m), sorted(sortBatches), slotCount(std::max<std::size_t>(slots, 1)),
+          slotArray(std::make_unique<Slot[]>(slotCount)) {
+        batch.reserve(slotCount);
+    }
+
+    FlatCombiningTreeMap(const FlatCombiningTreeMap&) = delete;
+    FlatCombiningTreeMap& operator=(const FlatCombiningTreeMap&) = delete;
+
+    std::optional<std::string> find(std::string_view key) {
+        Slot& s = publish(OpType::Find, key, {});
+        std::optional<std::string> out = std::move(s.found);
+        finish(s);
+        return out;
+    }
+
+    std::string get(std::string_view key) {
+        return find(key).value_or("");
+    }
+
+    void insert(std::string_view key, std::string_view value) {
+        finish(publish(OpType::Insert, key, value));
+    }
+
+    bool deleteKey(std::string_view key) {
+        Slot& s = publish(OpType::Delete, key, {});
+        bool out = s.deleted;
+        finish(s);
+        return out;
+    }
+
+    // Run fn(map) inside a batch, for anything the wrapper does not offer
+    // (scans, size, memory usage...). fn must not call back into the wrapper.
+    template <typename Fn>
+    void withMap(Fn&& fn) {
+        auto call = [](void* ctx, TreeMap& m) { (*static_cast<std::remove_reference_t<Fn>*>(ctx))(m); };
+        Slot& s = claim();
+        s.call = call;
+        s.context = &fn;
+        finish(submit(s, OpType::Call, {}, {}));
+    }
+
+    std::size_t size() {
+        std::size_t n = 0;
+        withMap([&](TreeMap& m) { n = m.size(); });
+        return n;
+    }
+
+    FlatCombiningStats stats() const {
+        FlatCombiningStats s;
+        s.batches = batches.load(std::memory_order_relaxed);
+        s.operations = operations.load(std::memory_order_relaxed);
+        s.largestBatch = largestBatch.load(std::memory_order_relaxed);
+        return s;
+    }
+
+private:
+    enum class OpType : std::uint8_t { Find, Insert, Delete, Call };
+
+    enum SlotState : int { Free, Writing, Pending, Done };
+
+    struct alignas(64) Slot {
+        std::atomic<int> state{Free};
+        OpType type = OpType::Find;
+        std::string_view key;     // caller's memory; it waits for the result
+        std::string_view value;
+        void (*call)(void*, TreeMap&) = nullptr;
+        void* context = nullptr;
+
+        std::optional<std::string> found;
+        bool deleted = false;
+        std::exception_ptr error;
+    };
+
+    TreeMap& map;
+    bool sorted;
+    std::size_t slotCount;
+    std::unique_ptr<Slot[]> slotArray;
+
+    alignas(64) std::atomic<bool> combining{false};
+    std::vector<Slot*> batch;    // combiner only
+
+    std::atomic<std::uint64_t> batches{0};
+    std::atomic<std::uint64_t> operations{0};
+    std::atomic<std::uint64_t> largestBatch{0};
+
+    // Free slot, probing from one picked by thread id so a thread usually
+    // gets the same uncontended slot (and cache line) every time
+    Slot& claim() {
+        std::size_t start = std::hash<std::thread::id>{}(std::this_thread::get_id()) % slotCount;
+        while (true) {
+            for (std::size_t i = 0; i < slotCount; ++i) {
+                Slot& s = slotArray[(start + i) % slotCount];
+                int expected = Free;
+                if (s.state.load(std::memory_order_relaxed) == Free &&
+                    s.state.compare_exchange_strong(expected, Writing, std::memory_order_acquire))
+                    return s;
+            }
+            std::this_thread::yield(); // more threads than slots
+        }
+    }
+
+    Slot& publish(OpType type, std::string_view key, std::string_view value) {
+        return submit(claim(), type, key, value);
+    }
+
+    // Hand the operation over and wait for a combiner (possibly us) to run it
+    Slot& submit(Slot& s, OpType type, std::string_view key, std::string_view value) {
+        s.type = type;
+        s.key = key;
+        s.value = value;
+        s.state.store(Pending, std::memory_order_release);
+
+        for (std::size_t spins = 0; s.state.load(std::memory_order_acquire) != Done; ++spins) {
+            if (!combining.load(std::memory_order_relaxed) &&
+                !combining.exchange(true, std::memory_order_acquire)) {
+                combine();
+                combining.store(false, std::memory_order_release);
+            } else if (spins % 64 == 63) {
+                std::this_thread::yield();
+            }
+        }
+        return s;
+    }
+
+    // Collect the result; rethrows what the operation threw
+    void finish(Slot& s) {
+        std::exception_ptr error = std::move(s.error);
+        s.found.reset();
+        s.error = nullptr;
+        s.state.store(Free, std::memory_order_release);
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    void combine() {
+        batch.clear();
+        for (std::size_t i = 0; i < slotCount; ++i)
+            if (slotArray[i].state.load(std::memory_order_acquire) == Pending)
+                batch.push_back(&slotArray[i]);
+        if (batch.empty()) return;
+
+        if (sorted)
+            std::sort(batch.begin(), batch.end(), [](const Slot* a, const Slot* b) { return a->key < b->key; });
+
+        for (Slot* s : batch) {
+            try {
+                run(*s);
+            } catch (...) {
+                s->error = std::current_exception();
+            }
+            s->state.store(Done, std::memory_order_release);
+        }
+
+        batches.fetch_add(1, std::memory_order_relaxed);
+        operations.fetch_add(batch.size(), std::memory_order_relaxed);
+        if (batch.size() > largestBatch.load(std::memory_order_relaxed))
+            largestBatch.store(batch.size(), std::memory_order_relaxed);
+    }
+
+    void run(Slot& s) {
+        switch (s.type) {
+        case OpType::Find:
+            s.found = map.find(std::string(s.key));
+            break;
+        case OpType::Insert:
+            map.insert(s.key, s.value);
+            break;
+        case OpType::Delete:
+            s.deleted = map.deleteKey(std::string(s.key));
+            break;
+        case OpType::Call:
+            s.call(s.context, map);
+            break;
+        }
+    }
+};
+
+#endif // FLAT_COMBINING_HPP
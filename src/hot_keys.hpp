@@ -0,0 +1,173 @@
+#ifndef HOT_KEYS_HPP
+#define HOT_KEYS_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// =======================
+// HotKeySketch
+// =======================
+
+struct HotKey {
+    std::string key;
+    std::uint64_t count = 0;   // estimated accesses (an upper bound)
+    std::uint64_t error = 0;   // count may overstate the truth by this much
+    double rate = 0;           // estimated accesses per second
+};
+
+// Space-saving heavy-hitter sketch: `capacity` counters in a min-heap.
+// A tracked key bumps its counter; an untracked one replaces the smallest
+// counter and inherits its count as error. Any key accessed more than
+// total/capacity times is guaranteed to be tracked. With sampleEvery > 1
+// only about one access in sampleEvery is recorded (and counts are scaled
+// back up), which keeps the per-operation cost to a random draw.
+class HotKeySketch {
+public:
+    explicit HotKeySketch(std::size_t capacity, std::uint32_t sampleEvery = 1)
+        : limit(std::max<std::size_t>(capacity, 1)), every(std::max<std::uint32_t>(sampleEvery, 1)) {
+        slots.reserve(limit);
+        heap.reserve(limit);
+        position.reserve(limit);
+        index.reserve(limit);
+    }
+
+    void record(std::string_view key) {
+        ++seen;
+        if (every > 1) {
+            rng ^= rng << 13;
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            if (rng % every != 0) return;
+        }
+
+        auto it = index.find(key);
+        if (it != index.end()) {
+            ++slots[it->second].count;
+            siftDown(position[it->second]);
+            return;
+        }
+
+        if (slots.size() < limit) {
+            slots.push_back(Counter{std::string(key), 1, 0});
+            heap.push_back(slots.size() - 1);
+            position.push_back(heap.size() - 1);
+            index.emplace(slots.back().key, slots.size() - 1);
+            siftUp(heap.size() - 1);
+            return;
+        }
+
+        // Take over the smallest counter; its count becomes our error
+        std::size_t slot = heap.front();
+        Counter& victim = slots[slot];
+        index.erase(victim.key);
+        victim.key.assign(key);
+        victim.error = victim.count;
+        ++victim.count;
+        index.emplace(victim.key, slot);
+        siftDown(0);
+    }
+
+    // The k keys with the highest estimated counts, hottest first
+    std::vector<HotKey> top(std::size_t k) const {
+        std::vector<const Counter*> order;
+        order.reserve(slots.size());
+        for (const Counter& c : slots)
+            order.push_back(&c);
+        k = std::min(k, order.size());
+        std::partial_sort(order.begin(), order.begin() + static_cast<std::ptrdiff_t>(k), order.end(),
+                          [](const Counter* a, const Counter* b) { return a->count > b->count; });
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+        std::vector<HotKey> out;
+        out.reserve(k);
+        for (std::size_t i = 0; i < k; ++i) {
+            HotKey h;
+            h.key = order[i]->key;
+            h.count = order[i]->count * every;
+            h.error = order[i]->error * every;
+            h.rate = seconds > 0 ? static_cast<double>(h.count) / seconds : 0;
+            out.push_back(std::move(h));
+        }
+        return out;
+    }
+
+    // Accesses offered to record(), sampled or not
+    std::uint64_t observed() const {
+        return seen;
+    }
+
+    // Forget everything and restart the rate clock
+    void reset() {
+        slots.clear();
+        heap.clear();
+        position.clear();
+        index.clear();
+        seen = 0;
+        since = std::chrono::steady_clock::now();
+    }
+
+private:
+    struct Counter {
+        std::string key;
+        std::uint64_t count;
+        std::uint64_t error;
+    };
+
+    struct Hash {
+        using is_transparent = void;
+        std::size_t operator()(std::string_view s) const {
+            return std::hash<std::string_view>{}(s);
+        }
+    };
+
+    std::size_t limit;
+    std::uint32_t every;
+    std::vector<Counter> slots;
+    std::vector<std::size_t> heap;       // slot numbers, min-heap on count
+    std::vector<std::size_t> position;   // slot -> index in heap
+    std::unordered_map<std::string, std::size_t, Hash, std::equal_to<>> index;   // key -> slot
+    std::uint64_t seen = 0;
+    std::uint64_t rng = 0x9E3779B97F4A7C15ull;
+    std::chrono::steady_clock::time_point since = std::chrono::steady_clock::now();
+
+    std::uint64_t countAt(std::size_t i) const {
+        return slots[heap[i]].count;
+    }
+
+    void swapAt(std::size_t i, std::size_t j) {
+        std::swap(heap[i], heap[j]);
+        position[heap[i]] = i;
+        position[heap[j]] = j;
+    }
+
+    void siftUp(std::size_t i) {
+        while (i > 0) {
+            std::size_t parent = (i - 1) / 2;
+            if (countAt(parent) <= countAt(i)) break;
+            swapAt(parent, i);
+            i = parent;
+        }
+    }
+
+    void siftDown(std::size_t i) {
+        while (true) {
+            std::size_t smallest = i;
+            for (std::size_t c = 2 * i + 1; c <= 2 * i + 2 && c < heap.size(); ++c)
+                if (countAt(c) < countAt(smallest))
+                    smallest = c;
+            if (smallest == i) break;
+            swapAt(smallest, i);
+            i = smallest;
+        }
+    }
+};
+
+#endif // HOT_KEYS_HPP
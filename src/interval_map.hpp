@@ -0,0 +1,146 @@
+#ifndef INTERVAL_MAP_HPP
+#define INTERVAL_MAP_HPP
+
+#include <cstddef>
+#include <functional>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "tree.hpp"
+
+// =======================
+// IntervalEntry
+// =======================
+
+// Closed interval [lo, hi] with a value. Ordered by (lo, hi); maxHi caches
+// the largest hi in the node's subtree and is kept up to date by the tree.
+template <typename K, typename V>
+struct IntervalEntry {
+    K lo{};
+    K hi{};
+    V value{};
+    K maxHi{};
+
+    IntervalEntry() = default;
+
+    IntervalEntry(K l, K h, V v = V())
+        : lo(std::move(l)), hi(std::move(h)), value(std::move(v)), maxHi(hi) {}
+
+    bool operator<(const IntervalEntry& other) const {
+        return lo < other.lo || (!(other.lo < lo) && hi < other.hi);
+    }
+};
+
+struct MaxEndpoint {
+    static constexpr bool enabled = true;
+
+    template <typename E>
+    void operator()(E& e, const E* left, const E* right) const {
+        e.maxHi = e.hi;
+        if (left && e.maxHi < left->maxHi) e.maxHi = left->maxHi;
+        if (right && e.maxHi < right->maxHi) e.maxHi = right->maxHi;
+    }
+};
+
+// =======================
+// IntervalMap
+// =======================
+
+// Map from closed intervals to values, e.g. IP ranges or time windows.
+// Stabbing (all intervals containing a point) and overlap queries skip
+// every subtree whose maxHi ends before the query and, since nodes are
+// ordered by lo, everything right of a node starting after it. Each of
+// the k reported intervals may cost a descent of its own, so a query is
+// O(depth) with no matches and O(k * depth) in general, not O(depth + k).
+// The deepest node a query reaches counts as accessed (splayed, by
+// default), which keeps depth O(log n) amortized. Intervals with the same
+// endpoints are one entry.
+template <typename K, typename V>
+class IntervalMap {
+public:
+    using Entry = IntervalEntry<K, V>;
+
+    // Insert or replace the value of [lo, hi]; requires !(hi < lo)
+    void insert(const K& lo, const K& hi, V value) {
+        tree.insert(Entry(lo, hi, std::move(value)));
+    }
+
+    bool erase(const K& lo, const K& hi) {
+        return tree.erase(Entry(lo, hi));
+    }
+
+    const V* find(const K& lo, const K& hi) {
+        auto* node = tree.findNode(Entry(lo, hi));
+        return node ? &node->data.value : nullptr;
+    }
+
+    // Visit every interval containing `point`, in (lo, hi) order, until
+    // fn(lo, hi, value) returns false
+    template <typename Fn>
+    void stab(const K& point, Fn fn) {
+        overlapping(point, point, fn);
+    }
+
+    // Visit every interval intersecting [lo, hi], in (lo, hi) order, until
+    // fn(lo, hi, value) returns false. fn must not modify the map.
+    template <typename Fn>
+    void overlapping(const K& lo, const K& hi, Fn fn) {
+        // Iterative in-order walk: a splay tree can be a long path
+        stack.clear();
+        Node* n = tree.root;
+        std::size_t depth = 0;
+        Node* deepest = nullptr;
+        std::size_t deepestDepth = 0;
+
+        while (true) {
+            for (; n && !(n->data.maxHi < lo); n = n->left, ++depth) {
+                stack.emplace_back(n, depth);
+                if (!deepest || depth > deepestDepth) {
+                    deepest = n;
+                    deepestDepth = depth;
+                }
+            }
+            if (stack.empty())
+                break;
+
+            std::tie(n, depth) = stack.back();
+            stack.pop_back();
+            if (hi < n->data.lo)
+                break; // everything after n starts too late
+            if (!(n->data.hi < lo) && !fn(n->data.lo, n->data.hi, n->data.value))
+                break;
+            n = n->right;
+            ++depth;
+        }
+        tree.accessed(deepest, deepestDepth);
+    }
+
+    // Values of every interval containing `point`
+    std::vector<V> stabbing(const K& point) {
+        std::vector<V> out;
+        stab(point, [&](const K&, const K&, const V& v) {
+            out.push_back(v);
+            return true;
+        });
+        return out;
+    }
+
+    std::size_t size() const {
+        return tree.size();
+    }
+
+    void clear() {
+        tree.clear();
+    }
+
+private:
+    using Tree = SplayTree<Entry, std::less<Entry>, MaxEndpoint>;
+    using Node = typename Tree::Node;
+
+    Tree tree;
+
+    std::vector<std::pair<Node*, std::size_t>> stack;
+};
+
+#endif // INTERVAL_MAP_HPP
@@ -0,0 +1,190 @@
+#ifndef KEY_ENCODING_HPP
+#define KEY_ENCODING_HPP
+
+#include <chrono>
+#include <cmath>
+#include <concepts>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// =======================
+// Composite key encoding
+// =======================
+
+// Encodes a tuple of fields into one string whose bytewise order is the
+// tuple order, so a plain (bytewise) TreeMap sorts composite keys without
+// a custom comparator and a leading-fields prefix selects a contiguous
+// range (TreeMap::scanPrefix). Fields carry no type tags; the reader must
+// know the schema.
+//
+//   string     bytes with 00 escaped as 00 FF, terminated by 00 01
+//   int64      big endian with the sign bit flipped
+//   uint64     big endian
+//   double     IEEE bits, sign flipped for positives, all flipped for
+//              negatives; every NaN is written as the one positive quiet
+//              NaN, so NaNs are equal and sort after +inf
+//   timestamp  int64 nanoseconds since the system_clock epoch
+class KeyEncoder {
+public:
+    using TimePoint = std::chrono::system_clock::time_point;
+
+    KeyEncoder& appendString(std::string_view s) {
+        for (char c : s) {
+            out.push_back(c);
+            if (c == '\0')
+                out.push_back(static_cast<char>(0xFF));
+        }
+        out.push_back('\0');
+        out.push_back('\1');
+        return *this;
+    }
+
+    KeyEncoder& appendUint64(std::uint64_t v) {
+        for (int shift = 56; shift >= 0; shift -= 8)
+            out.push_back(static_cast<char>((v >> shift) & 0xFF));
+        return *this;
+    }
+
+    KeyEncoder& appendInt64(std::int64_t v) {
+        return appendUint64(static_cast<std::uint64_t>(v) ^ (std::uint64_t{1} << 63));
+    }
+
+    KeyEncoder& appendDouble(double v) {
+        if (std::isnan(v))
+            v = std::numeric_limits<double>::quiet_NaN();
+        std::uint64_t bits;
+        std::memcpy(&bits, &v, sizeof(bits));
+        bits = (bits >> 63) ? ~bits : bits ^ (std::uint64_t{1} << 63);
+        return appendUint64(bits);
+    }
+
+    KeyEncoder& appendTimestamp(TimePoint t) {
+        return appendInt64(std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count());
+    }
+
+    const std::string& str() const {
+        return out;
+    }
+
+    std::string release() {
+        return std::move(out);
+    }
+
+private:
+    std::string out;
+};
+
+// Reads fields back in the order they were appended. Throws
+// std::runtime_error on truncated or malformed input.
+class KeyDecoder {
+public:
+    using TimePoint = KeyEncoder::TimePoint;
+
+    explicit KeyDecoder(std::string_view encoded)
+        : in(encoded) {}
+
+    std::string readString() {
+        std::string s;
+        while (true) {
+            if (pos >= in.size())
+                throw std::runtime_error("KeyDecoder: unterminated string");
+            char c = in[pos++];
+            if (c != '\0') {
+                s.push_back(c);
+                continue;
+            }
+            if (pos >= in.size())
+                throw std::runtime_error("KeyDecoder: unterminated string");
+            char next = in[pos++];
+            if (next == '\1')
+                return s;
+            if (next != static_cast<char>(0xFF))
+                throw std::runtime_error("KeyDecoder: bad string escape");
+            s.push_back('\0');
+        }
+    }
+
+    std::uint64_t readUint64() {
+        if (in.size() - pos < 8)
+            throw std::runtime_error("KeyDecoder: truncated integer");
+        std::uint64_t v = 0;
+        for (int i = 0; i < 8; ++i)
+            v = (v << 8) | static_cast<unsigned char>(in[pos++]);
+        return v;
+    }
+
+    std::int64_t readInt64() {
+        return static_cast<std::int64_t>(readUint64() ^ (std::uint64_t{1} << 63));
+    }
+
+    double readDouble() {
+        std::uint64_t bits = readUint64();
+        bits = (bits >> 63) ? bits ^ (std::uint64_t{1} << 63) : ~bits;
+        double v;
+        std::memcpy(&v, &bits, sizeof(v));
+        return v;
+    }
+
+    TimePoint readTimestamp() {
+        std::chrono::nanoseconds ns(readInt64());
+        return TimePoint(std::chrono::duration_cast<TimePoint::duration>(ns));
+    }
+
+    bool atEnd() const {
+        return pos == in.size();
+    }
+
+private:
+    std::string_view in;
+    std::size_t pos = 0;
+};
+
+// ---- one-call helpers ----
+
+inline void appendField(KeyEncoder& e, std::string_view v) { e.appendString(v); }
+inline void appendField(KeyEncoder& e, const char* v) { e.appendString(v); }
+inline void appendField(KeyEncoder& e, const std::string& v) { e.appendString(v); }
+inline void appendField(KeyEncoder& e, KeyEncoder::TimePoint v) { e.appendTimestamp(v); }
+
+// Integers by signedness, whatever their width; bool is not a number here
+template <std::signed_integral I>
+void appendField(KeyEncoder& e, I v) { e.appendInt64(v); }
+
+template <std::unsigned_integral U>
+    requires(!std::same_as<U, bool>)
+void appendField(KeyEncoder& e, U v) { e.appendUint64(v); }
+
+template <std::floating_point F>
+void appendField(KeyEncoder& e, F v) { e.appendDouble(static_cast<double>(v)); }
+
+// encodeKey("user", 42, now) == KeyEncoder().appendString("user")...;
+// signed integers encode as int64, unsigned as uint64, floats as double
+template <typename... Fields>
+std::string encodeKey(const Fields&... fields) {
+    KeyEncoder e;
+    (appendField(e, fields), ...);
+    return e.release();
+}
+
+// Smallest string greater than every string starting with `prefix`, for
+// half-open range bounds; nullopt if there is none (empty or all 0xFF)
+inline std::optional<std::string> prefixUpperBound(std::string_view prefix) {
+    std::string bound(prefix);
+    while (!bound.empty()) {
+        unsigned char last = static_cast<unsigned char>(bound.back());
+        if (last != 0xFF) {
+            bound.back() = static_cast<char>(last + 1);
+            return bound;
+        }
+        bound.pop_back();
+    }
+    return std::nullopt;
+}
+
+#endif // KEY_ENCODING_HPP
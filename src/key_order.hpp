@@ -0,0 +1,146 @@
+#ifndef KEY_ORDER_HPP
+#define KEY_ORDER_HPP
+
+#include <cstddef>
+#include <functional>
+#include <locale>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// =======================
+// Key orders
+// =======================
+
+// How a TreeMap orders its keys. Anything but Bytewise is implemented by
+// computing a sort key once per stored key (and once per lookup), so tree
+// descents stay plain byte comparisons instead of re-folding both sides
+// at every level.
+enum class KeyOrder {
+    Bytewise,          // std::string order (the default)
+    CaseInsensitive,   // ASCII case folded
+    Natural,           // embedded decimal numbers compare by value
+    Locale             // std::collate<char>::transform of the given locale
+};
+
+// ASCII lowercase; bytes >= 0x80 are left alone
+inline std::string foldCase(std::string_view key) {
+    std::string out(key);
+    for (char& c : out)
+        if (c >= 'A' && c <= 'Z')
+            c = static_cast<char>(c - 'A' + 'a');
+    return out;
+}
+
+namespace key_order_detail {
+
+// Order-preserving length: one byte below 255, else 0xFF + 4 bytes BE
+inline void appendLength(std::string& out, std::size_t n) {
+    if (n < 0xFF) {
+        out.push_back(static_cast<char>(n));
+        return;
+    }
+    out.push_back(static_cast<char>(0xFF));
+    for (int shift = 24; shift >= 0; shift -= 8)
+        out.push_back(static_cast<char>((n >> shift) & 0xFF));
+}
+
+inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+} // namespace key_order_detail
+
+// Natural order as bytes: "key_2" < "key_10" < "key_10a", by one memcmp.
+// Each digit run becomes '0', the length of the number without leading
+// zeros, then its significant digits, so longer numbers sort later and
+// equal lengths compare digit by digit. Text bytes are copied (NUL as
+// 00 FF). If any run had leading zeros, 00 01 and the zero counts are
+// appended as a final tie-break, keeping "7" and "007" distinct keys.
+inline std::string naturalSortKey(std::string_view key) {
+    using namespace key_order_detail;
+    std::string out;
+    out.reserve(key.size() + 4);
+    std::string zeros;
+    bool anyZeros = false;
+
+    for (std::size_t i = 0; i < key.size();) {
+        if (!isDigit(key[i])) {
+            out.push_back(key[i]);
+            if (key[i] == '\0')
+                out.push_back(static_cast<char>(0xFF));
+            ++i;
+            continue;
+        }
+
+        std::size_t start = i;
+        while (i < key.size() && key[i] == '0')
+            ++i;
+        std::size_t digits = i;
+        while (i < key.size() && isDigit(key[i]))
+            ++i;
+
+        out.push_back('0');
+        appendLength(out, i - digits);
+        out.append(key.substr(digits, i - digits));
+        appendLength(zeros, digits - start);
+        anyZeros |= digits != start;
+    }
+
+    if (anyZeros) {
+        out.push_back('\0');
+        out.push_back('\1');
+        out += zeros;
+    }
+    return out;
+}
+
+// Bytes whose plain comparison matches the locale's collation of `key`
+inline std::string collationKey(std::string_view key, const std::locale& loc) {
+    const auto& coll = std::use_facet<std::collate<char>>(loc);
+    return coll.transform(key.data(), key.data() + key.size());
+}
+
+// =======================
+// KeyNormalizer
+// =======================
+
+// Maps a key to its binary-comparable sort key. Keys with equal sort keys
+// are the same entry. An empty normalizer means bytewise order with no
+// stored sort key at all.
+class KeyNormalizer {
+public:
+    using Fn = std::function<std::string(std::string_view)>;
+
+    KeyNormalizer() = default;
+
+    explicit KeyNormalizer(Fn f)
+        : fn(std::move(f)) {}
+
+    static KeyNormalizer forOrder(KeyOrder order, const std::locale& loc = std::locale()) {
+        switch (order) {
+        case KeyOrder::CaseInsensitive:
+            return KeyNormalizer(foldCase);
+        case KeyOrder::Natural:
+            return KeyNormalizer(naturalSortKey);
+        case KeyOrder::Locale:
+            return KeyNormalizer([loc](std::string_view key) { return collationKey(key, loc); });
+        case KeyOrder::Bytewise:
+            break;
+        }
+        return KeyNormalizer();
+    }
+
+    bool identity() const {
+        return !fn;
+    }
+
+    std::string operator()(std::string_view key) const {
+        return fn ? fn(key) : std::string(key);
+    }
+
+private:
+    Fn fn;
+};
+
+#endif // KEY_ORDER_HPP
@@ -0,0 +1,232 @@
+#ifndef MVCC_HPP
+#define MVCC_HPP
+
+#include <cstdint>
+#include <optional>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "tree.hpp"
+
+// =======================
+// VersionedEntry
+// =======================
+
+struct Version {
+    std::uint64_t commitTs = 0;
+    bool deleted = false;      // tombstone
+    std::string value;
+};
+
+// One key and its version chain, oldest first
+class VersionedEntry {
+public:
+    std::string key;
+    std::vector<Version> versions;
+    std::uint64_t prunedAt = 0;   // horizon of the last prune
+
+    VersionedEntry() = default;
+
+    explicit VersionedEntry(std::string_view k)
+        : key(k) {}
+
+    bool operator<(const VersionedEntry& other) const {
+        return key < other.key;
+    }
+    bool operator>(const VersionedEntry& other) const {
+        return key > other.key;
+    }
+
+    // Newest version committed at or before ts, if any
+    const Version* visibleAt(std::uint64_t ts) const {
+        for (auto it = versions.rbegin(); it != versions.rend(); ++it)
+            if (it->commitTs <= ts)
+                return &*it;
+        return nullptr;
+    }
+
+    // Drop versions no reader at or after `horizon` can see: everything
+    // older than the newest version committed at or before the horizon
+    void prune(std::uint64_t horizon) {
+        prunedAt = horizon;
+        std::size_t keepFrom = 0;
+        for (std::size_t i = 0; i < versions.size(); ++i)
+            if (versions[i].commitTs <= horizon)
+                keepFrom = i;
+        if (keepFrom)
+            versions.erase(versions.begin(), versions.begin() + static_cast<std::ptrdiff_t>(keepFrom));
+    }
+};
+
+// =======================
+// VersionedTreeMap
+// =======================
+
+// A read asked for a timestamp older than what garbage collection kept
+class SnapshotTooOld : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Multi-version TreeMap: every write gets a commit timestamp from a
+// logical clock and is appended to the key's version chain, so reads can
+// be pinned to a point in time with get(key, ts) and scan(from, ts, fn)
+// while later writes keep landing. openSnapshot() pins a timestamp
+// against garbage collection; versions older than the oldest pinned
+// snapshot are pruned as chains grow and by collectGarbage(). Reading
+// at a timestamp whose versions may already be gone throws
+// SnapshotTooOld rather than answering from the wrong version.
+//
+// Like TreeMap, the structure is not thread safe (reads splay); versions
+// make a reader's view stable across interleaved writes, not lock-free.
+class VersionedTreeMap {
+public:
+    // A chain is pruned on write once it holds more than this many versions
+    static constexpr std::size_t kChainSlack = 4;
+
+    VersionedTreeMap() = default;
+
+    // Returns the commit timestamp
+    std::uint64_t insert(std::string_view key, std::string_view value) {
+        return write(key, false, value);
+    }
+
+    // Writes a tombstone; returns its timestamp, or 0 if the key was absent
+    std::uint64_t deleteKey(std::string_view key) {
+        auto* node = tree.findNode(VersionedEntry(key));
+        if (!node) return 0;
+        const Version* latest = node->data.visibleAt(clock);
+        if (!latest || latest->deleted) return 0;
+        return write(key, true, {});
+    }
+
+    std::optional<std::string> get(std::string_view key) {
+        return get(key, clock);
+    }
+
+    // Throws SnapshotTooOld if ts predates the oldest version kept
+    std::optional<std::string> get(std::string_view key, std::uint64_t ts) {
+        checkReadable(ts);
+        auto* node = tree.findNode(VersionedEntry(key));
+        if (!node) return std::nullopt;
+        const Version* v = node->data.visibleAt(ts);
+        if (!v || v->deleted) return std::nullopt;
+        return v->value;
+    }
+
+    // Entries with key >= from as of ts, in key order, until fn returns false.
+    // Throws SnapshotTooOld like get().
+    template <typename Fn>
+    void scan(std::string_view from, std::uint64_t ts, Fn fn) {
+        checkReadable(ts);
+        auto* node = tree.lowerBound(VersionedEntry(from));
+        for (; node; node = tree.successor(node)) {
+            const Version* v = node->data.visibleAt(ts);
+            if (!v || v->deleted) continue;
+            if (!fn(node->data.key, v->value))
+                return;
+        }
+    }
+
+    // Latest commit timestamp
+    std::uint64_t now() const {
+        return clock;
+    }
+
+    // Pin the current timestamp so its versions survive garbage collection
+    std::uint64_t openSnapshot() {
+        snapshots.insert(clock);
+        return clock;
+    }
+
+    void releaseSnapshot(std::uint64_t ts) {
+        auto it = snapshots.find(ts);
+        if (it != snapshots.end())
+            snapshots.erase(it);
+    }
+
+    // Prune every chain and drop keys whose only remaining version is an
+    // invisible tombstone. Returns the number of versions removed.
+    std::size_t collectGarbage() {
+        std::uint64_t h = horizon();
+        std::size_t removed = 0;
+        std::vector<std::string> dead;
+
+        for (auto* node = tree.first(); node; node = tree.successor(node)) {
+            VersionedEntry& e = node->data;
+            std::size_t before = e.versions.size();
+            e.prune(h);
+            removed += before - e.versions.size();
+            if (e.versions.size() != before)
+                prunedBefore = h;
+            if (e.versions.size() == 1 && e.versions[0].deleted && e.versions[0].commitTs <= h)
+                dead.push_back(e.key);
+        }
+
+        for (const std::string& key : dead) {
+            tree.erase(VersionedEntry(key));
+            ++removed;
+        }
+        if (!dead.empty())
+            prunedBefore = h;
+        totalVersions -= removed;
+        return removed;
+    }
+
+    // Keys present in the tree, including ones only holding tombstones
+    std::size_t keyCount() const {
+        return tree.size();
+    }
+
+    std::size_t versionCount() const {
+        return totalVersions;
+    }
+
+private:
+    SplayTree<VersionedEntry> tree;
+    std::uint64_t clock = 0;
+    std::multiset<std::uint64_t> snapshots;
+    std::size_t totalVersions = 0;
+    std::uint64_t prunedBefore = 0;   // reads below this may miss dropped versions
+
+    // Oldest timestamp any reader may still ask for. Never decreases:
+    // snapshots are only ever pinned at the current clock.
+    std::uint64_t horizon() const {
+        return snapshots.empty() ? clock : *snapshots.begin();
+    }
+
+    void checkReadable(std::uint64_t ts) const {
+        if (ts < prunedBefore)
+            throw SnapshotTooOld("VersionedTreeMap: timestamp " + std::to_string(ts) +
+                                 " is older than the retained history (" + std::to_string(prunedBefore) + ")");
+    }
+
+    std::uint64_t write(std::string_view key, bool deleted, std::string_view value) {
+        bool inserted = false;
+        auto* node = tree.findOrInsert(VersionedEntry(key), inserted);
+        VersionedEntry& e = node->data;
+
+        std::uint64_t ts = ++clock;
+        e.versions.push_back(Version{ts, deleted, std::string(value)});
+        ++totalVersions;
+
+        // Keep chains short without rescanning one on every write: prune
+        // once it has grown past the slack, and only if the horizon moved
+        // since its last prune (otherwise nothing new can be dropped)
+        std::uint64_t h = horizon();
+        if (e.versions.size() > kChainSlack && h != e.prunedAt) {
+            std::size_t before = e.versions.size();
+            e.prune(h);
+            if (e.versions.size() != before) {
+                totalVersions -= before - e.versions.size();
+                prunedBefore = h;
+            }
+        }
+        return ts;
+    }
+};
+
+#endif // MVCC_HPP
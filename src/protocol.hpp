@@ -0,0 +1,847 @@
+#ifndef PROTOCOL_HPP
+#define PROTOCOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/uio.h>
+
+// =======================
+// Command / Reply
+// =======================
+
+enum class CommandType {
+    Get,
+    Set,
+    Del,
+    MGet,
+    MSet,
+    Scan,
+    RangeByLex,
+    DbSize,
+    Ping,
+    Hello,
+    CommandDocs,
+    Quit,
+    Unknown
+};
+
+// One parsed request. Arguments are views into the connection's read
+// buffer and stay valid until the server consumes that input, i.e. until
+// the batch the command belongs to has executed.
+struct Command {
+    CommandType type = CommandType::Unknown;
+    std::string_view name;
+    std::vector<std::string_view> args;
+};
+
+enum class ReplyType {
+    Status,
+    Error,
+    Nil,
+    Bulk,
+    Integer,
+    Array,
+    Map            // elements alternate key, value
+};
+
+struct Reply {
+    ReplyType type = ReplyType::Nil;
+    std::string text;          // Status / Error / Bulk payload
+    long long integer = 0;
+    std::vector<Reply> elements;
+
+    static Reply status(std::string s) {
+        Reply r;
+        r.type = ReplyType::Status;
+        r.text = std::move(s);
+        return r;
+    }
+    static Reply error(std::string s) {
+        Reply r;
+        r.type = ReplyType::Error;
+        r.text = std::move(s);
+        return r;
+    }
+    static Reply nil() {
+        return Reply{};
+    }
+    static Reply bulk(std::string s) {
+        Reply r;
+        r.type = ReplyType::Bulk;
+        r.text = std::move(s);
+        return r;
+    }
+    static Reply number(long long n) {
+        Reply r;
+        r.type = ReplyType::Integer;
+        r.integer = n;
+        return r;
+    }
+};
+
+// =======================
+// ReplyBuffer
+// =======================
+
+// Encoded replies waiting for the socket, kept as segments for a gathered
+// write (sendmsg/writev). Framing and short payloads are packed into
+// shared segments; a payload of kGatherBytes or more is adopted as a
+// segment of its own, so value bytes are not copied again between the
+// tree lookup and the socket.
+class ReplyBuffer {
+public:
+    static constexpr std::size_t kGatherBytes = 256;
+
+    void append(std::string_view bytes) {
+        packed().append(bytes);
+        total += bytes.size();
+    }
+
+    void append(std::size_t count, char c) {
+        packed().append(count, c);
+        total += count;
+    }
+
+    void push_back(char c) {
+        packed().push_back(c);
+        ++total;
+    }
+
+    ReplyBuffer& operator+=(std::string_view bytes) {
+        append(bytes);
+        return *this;
+    }
+
+    ReplyBuffer& operator+=(char c) {
+        push_back(c);
+        return *this;
+    }
+
+    // Append a payload, taking over its buffer when it is large
+    void appendPayload(std::string&& bytes) {
+        if (bytes.size() < kGatherBytes) {
+            append(bytes);
+            return;
+        }
+        total += bytes.size();
+        segments.push_back(std::move(bytes));
+        lastPacked = false;
+    }
+
+    // Unsent bytes
+    std::size_t size() const { return total; }
+    bool empty() const { return total == 0; }
+    std::size_t segmentCount() const { return segments.size(); }
+
+    // Point up to maxParts iovecs at the unsent bytes, in order; returns
+    // how many were filled
+    std::size_t gather(iovec* parts, std::size_t maxParts) const {
+        std::size_t n = 0;
+        for (std::size_t i = 0; i < segments.size() && n < maxParts; ++i) {
+            std::size_t skip = i == 0 ? sentFront : 0;
+            if (segments[i].size() == skip) continue;
+            parts[n].iov_base = const_cast<char*>(segments[i].data() + skip);
+            parts[n].iov_len = segments[i].size() - skip;
+            ++n;
+        }
+        return n;
+    }
+
+    // Drop the first `bytes` unsent bytes (they went out)
+    void consume(std::size_t bytes) {
+        total -= bytes;
+        while (bytes > 0) {
+            std::size_t left = segments.front().size() - sentFront;
+            if (bytes < left) {
+                sentFront += bytes;
+                return;
+            }
+            bytes -= left;
+            popFront();
+        }
+        if (!segments.empty() && sentFront == segments.front().size())
+            popFront();
+    }
+
+    void clear() {
+        segments.clear();
+        sentFront = 0;
+        total = 0;
+    }
+
+    // Unsent bytes as one string (a copy; for tests and debugging)
+    std::string str() const {
+        std::string out;
+        out.reserve(total);
+        for (std::size_t i = 0; i < segments.size(); ++i)
+            out.append(segments[i], i == 0 ? sentFront : 0);
+        return out;
+    }
+
+private:
+    std::deque<std::string> segments;
+    std::size_t sentFront = 0;   // bytes of segments.front() already sent
+    std::size_t total = 0;
+    bool lastPacked = false;     // segments.back() takes small appends
+
+    std::string& packed() {
+        if (segments.empty() || !lastPacked) {
+            segments.emplace_back();
+            lastPacked = true;
+        }
+        return segments.back();
+    }
+
+    void popFront() {
+        segments.pop_front();
+        sentFront = 0;
+        if (segments.empty())
+            lastPacked = false;
+    }
+};
+
+// Malformed input; the server replies with an error and drops the client
+class ProtocolError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// =======================
+// ProtocolHandler
+// =======================
+
+class ProtocolHandler {
+public:
+    virtual ~ProtocolHandler() = default;
+
+    // Parse one command from the front of `input`. Returns the number of
+    // bytes it occupied, or 0 if more input is needed.
+    virtual std::size_t parse(std::string_view input, Command& out) = 0;
+
+    // Append the encoded reply; bulk payloads may be moved out of `reply`
+    virtual void encode(Reply& reply, ReplyBuffer& out) = 0;
+
+    // Encode into a flat string (tests, clients)
+    void encode(Reply reply, std::string& out) {
+        ReplyBuffer buffer;
+        encode(reply, buffer);
+        out += buffer.str();
+    }
+
+    // Switch wire-protocol version (RESP's HELLO); false if unsupported
+    virtual bool negotiate(int /*version*/) {
+        return false;
+    }
+
+    // Version currently spoken; 0 for unversioned protocols
+    virtual int protocolVersion() const {
+        return 0;
+    }
+};
+
+inline bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (std::size_t i = 0; i < a.size(); ++i) {
+        char x = a[i], y = b[i];
+        if (x >= 'a' && x <= 'z') x = static_cast<char>(x - 'a' + 'A');
+        if (y >= 'a' && y <= 'z') y = static_cast<char>(y - 'a' + 'A');
+        if (x != y) return false;
+    }
+    return true;
+}
+
+inline CommandType lookupCommand(std::string_view name) {
+    struct Entry {
+        const char* name;
+        CommandType type;
+    };
+    static const Entry table[] = {
+        {"GET", CommandType::Get},
+        {"SET", CommandType::Set},
+        {"DEL", CommandType::Del},
+        {"MGET", CommandType::MGet},
+        {"MSET", CommandType::MSet},
+        {"SCAN", CommandType::Scan},
+        {"RANGEBYLEX", CommandType::RangeByLex},
+        {"ZRANGEBYLEX", CommandType::RangeByLex},
+        {"DBSIZE", CommandType::DbSize},
+        {"PING", CommandType::Ping},
+        {"HELLO", CommandType::Hello},
+        {"COMMAND", CommandType::CommandDocs},
+        {"QUIT", CommandType::Quit},
+    };
+    for (const Entry& e : table)
+        if (equalsIgnoreCase(name, e.name))
+            return e.type;
+    return CommandType::Unknown;
+}
+
+// =======================
+// TextProtocol
+// =======================
+
+// Line protocol for humans and netcat:
+//   GET key            ->  VALUE <len>\n<bytes>\n  |  NOT_FOUND\n
+//   SET key value...   ->  OK\n      (value is the rest of the line)
+//   DEL key            ->  INT 1|0\n
+//   PING               ->  PONG\n
+//   QUIT               ->  closes the connection
+class TextProtocol : public ProtocolHandler {
+public:
+    static constexpr std::size_t kMaxLine = 1 << 20;
+
+    std::size_t parse(std::string_view input, Command& out) override {
+        std::size_t eol = input.find('\n');
+        if (eol == std::string_view::npos) {
+            if (input.size() > kMaxLine)
+                throw ProtocolError("line too long");
+            return 0;
+        }
+
+        std::string_view line = input.substr(0, eol);
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+
+        out.args.clear();
+        out.name = nextWord(line);
+
+        switch (lookupCommand(out.name)) {
+        case CommandType::Get:
+            out.type = CommandType::Get;
+            out.args.push_back(nextWord(line));
+            break;
+        case CommandType::Set:
+            out.type = CommandType::Set;
+            out.args.push_back(nextWord(line));
+            out.args.push_back(line); // rest of line, spaces included
+            break;
+        case CommandType::Del:
+            out.type = CommandType::Del;
+            out.args.push_back(nextWord(line));
+            break;
+        case CommandType::Ping:
+            out.type = CommandType::Ping;
+            break;
+        case CommandType::Quit:
+            out.type = CommandType::Quit;
+            break;
+        default:
+            out.type = CommandType::Unknown;
+            break;
+        }
+
+        return eol + 1;
+    }
+
+    using ProtocolHandler::encode;
+
+    void encode(Reply& reply, ReplyBuffer& out) override {
+        switch (reply.type) {
+        case ReplyType::Status:
+            out += reply.text;
+            out += '\n';
+            break;
+        case ReplyType::Error:
+            out += "ERROR ";
+            out += reply.text;
+            out += '\n';
+            break;
+        case ReplyType::Nil:
+            out += "NOT_FOUND\n";
+            break;
+        case ReplyType::Bulk:
+            out += "VALUE ";
+            out += std::to_string(reply.text.size());
+            out += '\n';
+            out.appendPayload(std::move(reply.text));
+            out += '\n';
+            break;
+        case ReplyType::Integer:
+            out += "INT ";
+            out += std::to_string(reply.integer);
+            out += '\n';
+            break;
+        case ReplyType::Array:
+        case ReplyType::Map:
+            for (Reply& r : reply.elements)
+                encode(r, out);
+            break;
+        }
+    }
+
+private:
+    // Pop the next space-delimited word off the front of `line`
+    static std::string_view nextWord(std::string_view& line) {
+        std::size_t start = line.find_first_not_of(' ');
+        if (start == std::string_view::npos) {
+            line = {};
+            return {};
+        }
+        line.remove_prefix(start);
+        std::size_t end = line.find(' ');
+        std::string_view word = line.substr(0, end);
+        line.remove_prefix(end == std::string_view::npos ? line.size() : end + 1);
+        return word;
+    }
+};
+
+// =======================
+// RespProtocol
+// =======================
+
+// Redis serialization protocol, versions 2 and 3. Requests are arrays of
+// bulk strings; bulk payloads are handed out as views straight into the
+// read buffer, so a SET copies its value exactly once, into the node.
+// Inline (space separated) commands are accepted as well.
+class RespProtocol : public ProtocolHandler {
+public:
+    static constexpr std::size_t kMaxBulk = 512u * 1024 * 1024;
+    static constexpr std::size_t kMaxArgs = 1024 * 1024;
+    static constexpr std::size_t kMaxInline = 64 * 1024;
+
+    std::size_t parse(std::string_view input, Command& out) override {
+        out.args.clear();
+        if (input.empty()) return 0;
+        if (input[0] != '*')
+            return parseInline(input, out);
+
+        std::size_t pos = 1;
+        long long count = 0;
+        if (!readNumber(input, pos, count)) return 0;
+        if (count < 1 || static_cast<std::size_t>(count) > kMaxArgs)
+            throw ProtocolError("invalid multibulk length");
+
+        for (long long i = 0; i < count; ++i) {
+            if (pos >= input.size()) return 0;
+            if (input[pos] != '$')
+                throw ProtocolError("expected '$'");
+            ++pos;
+
+            long long len = 0;
+            if (!readNumber(input, pos, len)) return 0;
+            if (len < 0 || static_cast<std::size_t>(len) > kMaxBulk)
+                throw ProtocolError("invalid bulk length");
+
+            std::size_t n = static_cast<std::size_t>(len);
+            if (input.size() - pos < n + 2) return 0;
+            if (input[pos + n] != '\r' || input[pos + n + 1] != '\n')
+                throw ProtocolError("bad bulk terminator");
+
+            std::string_view arg = input.substr(pos, n);
+            if (i == 0)
+                out.name = arg;
+            else
+                out.args.push_back(arg);
+            pos += n + 2;
+        }
+
+        out.type = lookupCommand(out.name);
+        return pos;
+    }
+
+    using ProtocolHandler::encode;
+
+    void encode(Reply& reply, ReplyBuffer& out) override {
+        switch (reply.type) {
+        case ReplyType::Status:
+            out += '+';
+            out += reply.text;
+            out += "\r\n";
+            break;
+        case ReplyType::Error:
+            out += "-ERR ";
+            out += reply.text;
+            out += "\r\n";
+            break;
+        case ReplyType::Nil:
+            out += version >= 3 ? "_\r\n" : "$-1\r\n";
+            break;
+        case ReplyType::Bulk:
+            out += '$';
+            out += std::to_string(reply.text.size());
+            out += "\r\n";
+            out.appendPayload(std::move(reply.text));
+            out += "\r\n";
+            break;
+        case ReplyType::Integer:
+            out += ':';
+            out += std::to_string(reply.integer);
+            out += "\r\n";
+            break;
+        case ReplyType::Array:
+            out += '*';
+            out += std::to_string(reply.elements.size());
+            out += "\r\n";
+            for (Reply& r : reply.elements)
+                encode(r, out);
+            break;
+        case ReplyType::Map:
+            // RESP3 has a map type; RESP2 clients get the flat pair list
+            if (version >= 3) {
+                out += '%';
+                out += std::to_string(reply.elements.size() / 2);
+            } else {
+                out += '*';
+                out += std::to_string(reply.elements.size());
+            }
+            out += "\r\n";
+            for (Reply& r : reply.elements)
+                encode(r, out);
+            break;
+        }
+    }
+
+    bool negotiate(int v) override {
+        if (v != 2 && v != 3) return false;
+        version = v;
+        return true;
+    }
+
+    int protocolVersion() const override {
+        return version;
+    }
+
+private:
+    int version = 2;
+
+    // Parse "<digits>\r\n" at pos; false if the line is incomplete
+    static bool readNumber(std::string_view input, std::size_t& pos, long long& value) {
+        std::size_t eol = input.find("\r\n", pos);
+        if (eol == std::string_view::npos) {
+            if (input.size() - pos > 32)
+                throw ProtocolError("invalid length line");
+            return false;
+        }
+
+        bool negative = false;
+        std::size_t i = pos;
+        if (i < eol && input[i] == '-') {
+            negative = true;
+            ++i;
+        }
+        if (i == eol || eol - i > 18)
+            throw ProtocolError("invalid length");
+
+        long long v = 0;
+        for (; i < eol; ++i) {
+            char c = input[i];
+            if (c < '0' || c > '9')
+                throw ProtocolError("invalid length");
+            v = v * 10 + (c - '0');
+        }
+        value = negative ? -v : v;
+        pos = eol + 2;
+        return true;
+    }
+
+    std::size_t parseInline(std::string_view input, Command& out) {
+        std::size_t eol = input.find('\n');
+        if (eol == std::string_view::npos) {
+            if (input.size() > kMaxInline)
+                throw ProtocolError("inline command too long");
+            return 0;
+        }
+
+        std::string_view line = input.substr(0, eol);
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+
+        bool first = true;
+        while (!line.empty()) {
+            std::size_t start = line.find_first_not_of(' ');
+            if (start == std::string_view::npos) break;
+            line.remove_prefix(start);
+            std::size_t end = line.find(' ');
+            std::string_view word = line.substr(0, end);
+            line.remove_prefix(end == std::string_view::npos ? line.size() : end);
+
+            if (first)
+                out.name = word;
+            else
+                out.args.push_back(word);
+            first = false;
+        }
+
+        out.type = lookupCommand(out.name);
+        return eol + 1;
+    }
+};
+
+// =======================
+// BinaryProtocol
+// =======================
+
+// Compact framing for high-rate clients. A request is a batch:
+//
+//   header  u8 magic(0xB7) u8 version(1) u16 flags(0) u32 opCount u32 payloadBytes
+//   op      u8 opcode u32 keyLen u32 valueLen, key bytes, value bytes   (x opCount)
+//
+// The server waits for a whole batch, then hands every op out as a
+// Command whose key/value are views into the frame. Replies to one batch
+// come back as one batch:
+//
+//   header  u8 magic u8 version u16 flags u32 replyCount
+//   reply   u8 status u32 length, payload
+//
+// where Value/Status/Error carry bytes, Integer carries an 8-byte little
+// endian value, Nil carries nothing and Array's length is its element
+// count. All integers are little endian.
+class BinaryProtocol : public ProtocolHandler {
+public:
+    static constexpr unsigned char kMagic = 0xB7;
+    static constexpr unsigned char kVersion = 1;
+    static constexpr std::size_t kRequestHeader = 12;
+    static constexpr std::size_t kReplyHeader = 8;
+    static constexpr std::size_t kOpHeader = 9;
+    static constexpr std::size_t kReplyRecordHeader = 5;
+    static constexpr std::uint32_t kMaxOps = 1024 * 1024;
+    static constexpr std::uint32_t kMaxPayload = 1u << 30;
+
+    enum Opcode : std::uint8_t {
+        OpGet = 1,
+        OpSet = 2,
+        OpDel = 3,
+        OpPing = 4
+    };
+
+    enum Status : std::uint8_t {
+        StatusOk = 0,
+        StatusNil = 1,
+        StatusValue = 2,
+        StatusInteger = 3,
+        StatusError = 4,
+        StatusArray = 5
+    };
+
+    struct Op {
+        Opcode opcode;
+        std::string_view key;
+        std::string_view value;
+    };
+
+    struct DecodedReply {
+        Status status = StatusNil;
+        std::string bytes;
+        long long integer = 0;
+    };
+
+    std::size_t parse(std::string_view input, Command& out) override {
+        std::size_t used = 0;
+        if (opsLeft == 0) {
+            if (input.size() < kRequestHeader) return 0;
+            if (static_cast<unsigned char>(input[0]) != kMagic ||
+                static_cast<unsigned char>(input[1]) != kVersion)
+                throw ProtocolError("bad frame header");
+
+            std::uint32_t count = readU32(input.data() + 4);
+            std::uint32_t payload = readU32(input.data() + 8);
+            if (count == 0 || count > kMaxOps || payload > kMaxPayload)
+                throw ProtocolError("bad frame size");
+            if (input.size() - kRequestHeader < payload) return 0;
+
+            opsLeft = count;
+            payloadLeft = payload;
+            replyBatches.push_back(count);
+            used = kRequestHeader;
+        }
+
+        std::string_view rest = input.substr(used);
+        if (payloadLeft < kOpHeader || rest.size() < kOpHeader)
+            throw ProtocolError("truncated op");
+
+        std::uint8_t opcode = static_cast<std::uint8_t>(rest[0]);
+        std::uint32_t keyLen = readU32(rest.data() + 1);
+        std::uint32_t valueLen = readU32(rest.data() + 5);
+        std::size_t opBytes = kOpHeader + std::size_t{keyLen} + valueLen;
+        if (opBytes > payloadLeft || opBytes > rest.size())
+            throw ProtocolError("op overruns frame");
+
+        out.args.clear();
+        std::string_view key = rest.substr(kOpHeader, keyLen);
+        std::string_view value = rest.substr(kOpHeader + keyLen, valueLen);
+        switch (opcode) {
+        case OpGet:
+            out.type = CommandType::Get;
+            out.name = "GET";
+            out.args.push_back(key);
+            break;
+        case OpSet:
+            out.type = CommandType::Set;
+            out.name = "SET";
+            out.args.push_back(key);
+            out.args.push_back(value);
+            break;
+        case OpDel:
+            out.type = CommandType::Del;
+            out.name = "DEL";
+            out.args.push_back(key);
+            break;
+        case OpPing:
+            out.type = CommandType::Ping;
+            out.name = "PING";
+            break;
+        default:
+            throw ProtocolError("unknown opcode");
+        }
+
+        payloadLeft -= opBytes;
+        if (--opsLeft == 0 && payloadLeft != 0)
+            throw ProtocolError("trailing bytes in frame");
+        return used + opBytes;
+    }
+
+    using ProtocolHandler::encode;
+
+    void encode(Reply& reply, ReplyBuffer& out) override {
+        if (repliesLeft == 0) {
+            // A parse error is answered outside any batch, as a batch of one
+            std::uint32_t count = 1;
+            if (!replyBatches.empty()) {
+                count = replyBatches.front();
+                replyBatches.pop_front();
+            }
+            out.push_back(static_cast<char>(kMagic));
+            out.push_back(static_cast<char>(kVersion));
+            out.append(2, '\0');
+            appendU32(out, count);
+            repliesLeft = count;
+        }
+        encodeRecord(reply, out);
+        --repliesLeft;
+    }
+
+    // ---- client side helpers ----
+
+    static void appendBatch(std::string& out, const std::vector<Op>& ops) {
+        std::size_t payload = 0;
+        for (const Op& op : ops)
+            payload += kOpHeader + op.key.size() + op.value.size();
+
+        out.push_back(static_cast<char>(kMagic));
+        out.push_back(static_cast<char>(kVersion));
+        out.append(2, '\0');
+        appendU32(out, static_cast<std::uint32_t>(ops.size()));
+        appendU32(out, static_cast<std::uint32_t>(payload));
+
+        for (const Op& op : ops) {
+            out.push_back(static_cast<char>(op.opcode));
+            appendU32(out, static_cast<std::uint32_t>(op.key.size()));
+            appendU32(out, static_cast<std::uint32_t>(op.value.size()));
+            out.append(op.key);
+            out.append(op.value);
+        }
+    }
+
+    // Decode one reply batch from the front of `in`. Returns the bytes it
+    // occupied, or 0 if it is not complete yet. Array elements are
+    // flattened into `out` after the array record itself.
+    static std::size_t parseReplyBatch(std::string_view in, std::vector<DecodedReply>& out) {
+        if (in.size() < kReplyHeader) return 0;
+        if (static_cast<unsigned char>(in[0]) != kMagic)
+            throw ProtocolError("bad reply header");
+
+        std::uint32_t count = readU32(in.data() + 4);
+        std::size_t pos = kReplyHeader;
+        std::vector<DecodedReply> replies;
+        for (std::uint32_t i = 0; i < count; ++i) {
+            if (!readRecord(in, pos, replies)) return 0;
+        }
+        out.insert(out.end(), replies.begin(), replies.end());
+        return pos;
+    }
+
+private:
+    std::uint32_t opsLeft = 0;
+    std::size_t payloadLeft = 0;
+    std::deque<std::uint32_t> replyBatches;
+    std::uint32_t repliesLeft = 0;
+
+    static std::uint32_t readU32(const char* p) {
+        unsigned char b[4];
+        std::memcpy(b, p, 4);
+        return std::uint32_t{b[0]} | (std::uint32_t{b[1]} << 8) |
+               (std::uint32_t{b[2]} << 16) | (std::uint32_t{b[3]} << 24);
+    }
+
+    template <typename Out>
+    static void appendU32(Out& out, std::uint32_t v) {
+        for (int i = 0; i < 4; ++i)
+            out.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+    }
+
+    static void encodeRecord(Reply& reply, ReplyBuffer& out) {
+        switch (reply.type) {
+        case ReplyType::Status:
+            out.push_back(static_cast<char>(StatusOk));
+            appendU32(out, static_cast<std::uint32_t>(reply.text.size()));
+            out += reply.text;
+            break;
+        case ReplyType::Error:
+            out.push_back(static_cast<char>(StatusError));
+            appendU32(out, static_cast<std::uint32_t>(reply.text.size()));
+            out += reply.text;
+            break;
+        case ReplyType::Nil:
+            out.push_back(static_cast<char>(StatusNil));
+            appendU32(out, 0);
+            break;
+        case ReplyType::Bulk:
+            out.push_back(static_cast<char>(StatusValue));
+            appendU32(out, static_cast<std::uint32_t>(reply.text.size()));
+            out.appendPayload(std::move(reply.text));
+            break;
+        case ReplyType::Integer: {
+            out.push_back(static_cast<char>(StatusInteger));
+            appendU32(out, 8);
+            auto v = static_cast<std::uint64_t>(reply.integer);
+            for (int i = 0; i < 8; ++i)
+                out.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+            break;
+        }
+        case ReplyType::Array:
+        case ReplyType::Map:
+            out.push_back(static_cast<char>(StatusArray));
+            appendU32(out, static_cast<std::uint32_t>(reply.elements.size()));
+            for (Reply& r : reply.elements)
+                encodeRecord(r, out);
+            break;
+        }
+    }
+
+    static bool readRecord(std::string_view in, std::size_t& pos, std::vector<DecodedReply>& out) {
+        if (in.size() - pos < kReplyRecordHeader) return false;
+        DecodedReply r;
+        r.status = static_cast<Status>(static_cast<std::uint8_t>(in[pos]));
+        std::uint32_t len = readU32(in.data() + pos + 1);
+        pos += kReplyRecordHeader;
+
+        if (r.status == StatusArray) {
+            out.push_back(r);
+            for (std::uint32_t i = 0; i < len; ++i)
+                if (!readRecord(in, pos, out)) return false;
+            return true;
+        }
+
+        if (in.size() - pos < len) return false;
+        if (r.status == StatusInteger) {
+            std::uint64_t v = 0;
+            for (int i = 0; i < 8; ++i)
+                v |= std::uint64_t{static_cast<unsigned char>(in[pos + i])} << (8 * i);
+            r.integer = static_cast<long long>(v);
+        } else {
+            r.bytes.assign(in.substr(pos, len));
+        }
+        pos += len;
+        out.push_back(std::move(r));
+        return true;
+    }
+};
+
+#endif // PROTOCOL_HPP
@@ -0,0 +1,435 @@
+#ifndef REPLICATION_HPP
+#define REPLICATION_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "change_stream.hpp"
+#include "tree.hpp"
+
+// =======================
+// Replication wire format
+// =======================
+
+// Every record is
+//   u8 kind  u64 sequence  u32 keyLen  u32 valueLen  key  value
+// (little endian). A snapshot is SnapshotBegin, one Put per entry and
+// SnapshotEnd, stamped with the sequence number it started from. It is
+// sent in chunks while the primary keeps changing, so Put/Delete/Clear
+// records for later mutations are interleaved with it in the order they
+// happened; applying the stream in order gives the primary's state.
+namespace replication {
+
+enum class RecordKind : std::uint8_t {
+    SnapshotBegin = 1,
+    Put = 2,
+    Delete = 3,
+    SnapshotEnd = 4,
+    Clear = 5
+};
+
+constexpr std::size_t kRecordHeader = 17;
+
+inline void appendRecord(std::string& out, RecordKind kind, std::uint64_t seq,
+                         std::string_view key, std::string_view value) {
+    out.push_back(static_cast<char>(kind));
+    for (int i = 0; i < 8; ++i)
+        out.push_back(static_cast<char>((seq >> (8 * i)) & 0xFF));
+    for (std::uint32_t len : {static_cast<std::uint32_t>(key.size()), static_cast<std::uint32_t>(value.size())})
+        for (int i = 0; i < 4; ++i)
+            out.push_back(static_cast<char>((len >> (8 * i)) & 0xFF));
+    out.append(key);
+    out.append(value);
+}
+
+struct Record {
+    RecordKind kind;
+    std::uint64_t sequence;
+    std::string_view key;
+    std::string_view value;
+};
+
+// Decode one record from the front of `in`; returns bytes used, 0 if
+// incomplete. Throws std::runtime_error on an unknown record kind.
+inline std::size_t parseRecord(std::string_view in, Record& out) {
+    if (in.size() < kRecordHeader) return 0;
+
+    auto byte = [&](std::size_t i) { return static_cast<std::uint64_t>(static_cast<unsigned char>(in[i])); };
+    std::uint8_t kind = static_cast<std::uint8_t>(in[0]);
+    if (kind < 1 || kind > 5)
+        throw std::runtime_error("replication: bad record kind");
+
+    std::uint64_t seq = 0;
+    for (int i = 0; i < 8; ++i)
+        seq |= byte(1 + i) << (8 * i);
+    std::uint32_t keyLen = 0, valueLen = 0;
+    for (int i = 0; i < 4; ++i) {
+        keyLen |= static_cast<std::uint32_t>(byte(9 + i) << (8 * i));
+        valueLen |= static_cast<std::uint32_t>(byte(13 + i) << (8 * i));
+    }
+
+    std::size_t total = kRecordHeader + std::size_t{keyLen} + valueLen;
+    if (in.size() < total) return 0;
+
+    out.kind = static_cast<RecordKind>(kind);
+    out.sequence = seq;
+    out.key = in.substr(kRecordHeader, keyLen);
+    out.value = in.substr(kRecordHeader + keyLen, valueLen);
+    return total;
+}
+
+} // namespace replication
+
+// =======================
+// ReplicationPrimary
+// =======================
+
+// Ships a TreeMap's mutation stream to replica processes over a Unix
+// socket. Everything happens in pump(), which must be called from the
+// thread that mutates the map (e.g. once per server loop iteration):
+// it accepts replicas, sends each a snapshot, and forwards new mutations.
+// If the change ring overflows, every replica is re-snapshotted.
+//
+// Snapshots are generated kSnapshotChunk bytes at a time, only as fast as
+// the socket drains, so a large map never sits in memory twice. A replica
+// whose queued mutations (snapshot data not counted) exceed the backlog
+// limit is dropped.
+class ReplicationPrimary {
+public:
+    static constexpr std::size_t kMaxBacklog = 64 * 1024 * 1024;
+    static constexpr std::size_t kSnapshotChunk = 256 * 1024;
+
+    ReplicationPrimary(TreeMap& m, const std::string& socketPath, std::size_t ringCapacity = 1 << 16,
+                       std::size_t backlogLimit = kMaxBacklog)
+        : map(m), path(socketPath), capacity(ringCapacity), maxBacklog(backlogLimit) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path))
+            throw std::runtime_error("ReplicationPrimary: socket path too long");
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+        listenFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd < 0)
+            throw std::runtime_error("ReplicationPrimary: socket failed");
+        ::unlink(path.c_str());
+        if (::bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+            ::listen(listenFd, 16) < 0) {
+            ::close(listenFd);
+            throw std::runtime_error("ReplicationPrimary: cannot listen on " + path + ": " + std::strerror(errno));
+        }
+
+        subscription = map.subscribe(capacity);
+    }
+
+    ReplicationPrimary(const ReplicationPrimary&) = delete;
+    ReplicationPrimary& operator=(const ReplicationPrimary&) = delete;
+
+    ~ReplicationPrimary() {
+        subscription->cancel();
+        for (const Replica& r : replicas)
+            ::close(r.fd);
+        ::close(listenFd);
+        ::unlink(path.c_str());
+    }
+
+    // Accept, snapshot, forward and flush; returns mutations forwarded
+    std::size_t pump() {
+        acceptReplicas();
+
+        if (subscription->overflowed()) {
+            subscription->cancel();
+            subscription = map.subscribe(capacity);
+            for (Replica& r : replicas)
+                sendSnapshot(r);
+        }
+
+        events.clear();
+        subscription->readBatch(events, subscription->pending());
+        if (!events.empty()) {
+            for (Replica& r : replicas) {
+                std::size_t before = r.out.size();
+                for (const MutationEvent& e : events) {
+                    if (e.sequence <= r.snapshotSeq) continue; // already in its snapshot
+                    replication::appendRecord(r.out, recordKind(e.type), e.sequence, e.key, e.value);
+                }
+                queued(r, r.out.size() - before, false);
+            }
+        }
+
+        for (Replica& r : replicas) {
+            continueSnapshot(r);
+            flush(r);
+        }
+        std::erase_if(replicas, [](const Replica& r) {
+            if (!r.dead) return false;
+            ::close(r.fd);
+            return true;
+        });
+        return events.size();
+    }
+
+    std::size_t replicaCount() const {
+        return replicas.size();
+    }
+
+private:
+    struct Replica {
+        int fd = -1;
+        std::string out;
+        std::deque<std::pair<std::size_t, bool>> runs;   // `out` as (bytes, snapshot data?) runs
+        std::size_t snapshotQueued = 0;                  // unsent snapshot bytes in `out`
+        std::uint64_t snapshotSeq = 0;
+        bool snapshotting = false;
+        std::string resumeKey;                           // next key the snapshot copies
+        bool dead = false;
+    };
+
+    TreeMap& map;
+    std::string path;
+    std::size_t capacity;
+    std::size_t maxBacklog;
+    int listenFd = -1;
+    std::shared_ptr<ChangeSubscription> subscription;
+    std::vector<Replica> replicas;
+    std::vector<MutationEvent> events;
+
+    void acceptReplicas() {
+        while (true) {
+            int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;
+            replicas.emplace_back();
+            replicas.back().fd = fd;
+            sendSnapshot(replicas.back());
+        }
+    }
+
+    static replication::RecordKind recordKind(MutationType type) {
+        switch (type) {
+        case MutationType::Insert:
+            return replication::RecordKind::Put;
+        case MutationType::Delete:
+            return replication::RecordKind::Delete;
+        case MutationType::Clear:
+            break;
+        }
+        return replication::RecordKind::Clear;
+    }
+
+    // Account for `bytes` just appended to r.out
+    static void queued(Replica& r, std::size_t bytes, bool snapshot) {
+        if (bytes == 0) return;
+        if (!r.runs.empty() && r.runs.back().second == snapshot)
+            r.runs.back().first += bytes;
+        else
+            r.runs.emplace_back(bytes, snapshot);
+        if (snapshot)
+            r.snapshotQueued += bytes;
+    }
+
+    // Start a snapshot as of the current sequence number. Any mutation
+    // already waiting in the ring is covered by it and skipped for this
+    // replica. Unsent backlog is kept, since it may start with the tail of
+    // a partly sent record; SnapshotBegin makes the replica start over.
+    void sendSnapshot(Replica& r) {
+        r.snapshotSeq = map.lastSequence();
+        r.snapshotting = true;
+        r.resumeKey.clear();
+
+        std::size_t before = r.out.size();
+        replication::appendRecord(r.out, replication::RecordKind::SnapshotBegin, r.snapshotSeq, {}, {});
+        queued(r, r.out.size() - before, true);
+    }
+
+    // Queue the next chunk once the previous one has mostly drained.
+    // Entries changed after the snapshot began reach the replica as
+    // mutation records too, so a chunk may safely show newer values.
+    void continueSnapshot(Replica& r) {
+        using replication::RecordKind;
+        if (!r.snapshotting || r.snapshotQueued >= kSnapshotChunk) return;
+
+        std::size_t before = r.out.size();
+        bool finished = true;
+        map.scan(r.resumeKey, [&](const std::string& key, const std::string& value) {
+            if (r.out.size() - before >= kSnapshotChunk) {
+                r.resumeKey = key;
+                finished = false;
+                return false;
+            }
+            replication::appendRecord(r.out, RecordKind::Put, r.snapshotSeq, key, value);
+            return true;
+        });
+        if (finished) {
+            replication::appendRecord(r.out, RecordKind::SnapshotEnd, r.snapshotSeq, {}, {});
+            r.snapshotting = false;
+        }
+        queued(r, r.out.size() - before, true);
+    }
+
+    void flush(Replica& r) {
+        std::size_t sent = 0;
+        while (sent < r.out.size()) {
+            ssize_t n = ::send(r.fd, r.out.data() + sent, r.out.size() - sent, MSG_NOSIGNAL);
+            if (n > 0) {
+                sent += static_cast<std::size_t>(n);
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            r.dead = true;
+            return;
+        }
+        r.out.erase(0, sent);
+
+        for (std::size_t left = sent; left > 0;) {
+            auto& [bytes, snapshot] = r.runs.front();
+            std::size_t n = std::min(bytes, left);
+            if (snapshot)
+                r.snapshotQueued -= n;
+            bytes -= n;
+            left -= n;
+            if (bytes == 0)
+                r.runs.pop_front();
+        }
+
+        // A replica this far behind on live mutations is cut loose; it can
+        // reconnect and start over from a fresh snapshot
+        if (r.out.size() - r.snapshotQueued > maxBacklog)
+            r.dead = true;
+    }
+};
+
+// =======================
+// ReplicaClient
+// =======================
+
+// Follows a ReplicationPrimary and applies its stream to a local TreeMap,
+// which keeps serving reads in between. poll() applies every complete
+// record received so far, as one batch. A snapshot is built in a side
+// map and only replaces the local contents once it is complete, so a
+// connection lost mid-resync leaves the last good state in place.
+class ReplicaClient {
+public:
+    ReplicaClient(TreeMap& m, const std::string& primaryPath)
+        : map(m) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (primaryPath.size() >= sizeof(addr.sun_path))
+            throw std::runtime_error("ReplicaClient: socket path too long");
+        std::memcpy(addr.sun_path, primaryPath.c_str(), primaryPath.size() + 1);
+
+        fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+            std::string msg = std::strerror(errno);
+            if (fd >= 0) ::close(fd);
+            throw std::runtime_error("ReplicaClient: cannot connect to " + primaryPath + ": " + msg);
+        }
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    ReplicaClient(const ReplicaClient&) = delete;
+    ReplicaClient& operator=(const ReplicaClient&) = delete;
+
+    ~ReplicaClient() {
+        ::close(fd);
+    }
+
+    // Returns the number of records applied; throws if the primary went away
+    std::size_t poll() {
+        char buf[64 * 1024];
+        while (true) {
+            ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+            if (n > 0) {
+                in.append(buf, static_cast<std::size_t>(n));
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            connected = false;
+            break;
+        }
+
+        std::size_t applied = 0;
+        std::size_t pos = 0;
+        replication::Record rec{};
+        while (std::size_t used = replication::parseRecord(std::string_view(in).substr(pos), rec)) {
+            apply(rec);
+            pos += used;
+            ++applied;
+        }
+        in.erase(0, pos);
+
+        if (!connected && applied == 0)
+            throw std::runtime_error("ReplicaClient: primary closed the connection");
+        return applied;
+    }
+
+    // True once a complete snapshot has been applied
+    bool synced() const {
+        return haveSnapshot;
+    }
+
+    // Primary sequence number this replica reflects
+    std::uint64_t appliedSequence() const {
+        return applied;
+    }
+
+private:
+    TreeMap& map;
+    int fd = -1;
+    std::string in;
+    bool connected = true;
+    bool haveSnapshot = false;
+    std::uint64_t applied = 0;
+
+    std::unique_ptr<TreeMap> incoming;   // snapshot being received
+
+    void apply(const replication::Record& rec) {
+        using replication::RecordKind;
+        TreeMap& target = incoming ? *incoming : map;
+        switch (rec.kind) {
+        case RecordKind::SnapshotBegin:
+            incoming = std::make_unique<TreeMap>();
+            haveSnapshot = false;
+            break;
+        case RecordKind::Put:
+            target.insert(rec.key, rec.value);
+            break;
+        case RecordKind::Delete:
+            target.deleteKey(std::string(rec.key));
+            break;
+        case RecordKind::Clear:
+            target.clear();
+            break;
+        case RecordKind::SnapshotEnd:
+            if (incoming) {
+                map.clear();
+                incoming->scan("", [&](const std::string& key, const std::string& value) {
+                    map.insert(key, value);
+                    return true;
+                });
+                incoming.reset();
+            }
+            haveSnapshot = true;
+            break;
+        }
+        // Snapshot records carry the sequence the snapshot started from,
+        // which mutations interleaved with it have already passed
+        applied = rec.kind == RecordKind::SnapshotBegin ? rec.sequence : std::max(applied, rec.sequence);
+    }
+};
+
+#endif // REPLICATION_HPP
@@ -0,0 +1,269 @@
+#ifndef SEQUENCE_HPP
+#define SEQUENCE_HPP
+
+#include <cstddef>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "tree.hpp"
+
+// =======================
+// SequenceItem
+// =======================
+
+// One element of a SplaySequence: the value, its subtree's element count
+// (the implicit key) and a pending "reverse this subtree" flag
+template <typename T>
+struct SequenceItem {
+    T value;
+    std::size_t size = 1;
+    bool reversed = false;
+
+    SequenceItem(T v)
+        : value(std::move(v)) {}
+};
+
+struct SubtreeSize {
+    static constexpr bool enabled = true;
+
+    template <typename I>
+    void operator()(I& item, const I* left, const I* right) const {
+        item.size = 1 + (left ? left->size : 0) + (right ? right->size : 0);
+    }
+};
+
+// =======================
+// SplaySequence
+// =======================
+
+// Rope-style sequence on SplayTree's rotations: elements are keyed by
+// position, found through subtree sizes, so insertAt, eraseAt, split,
+// concat and reverse are all O(log n) amortized. reverse() only flips a
+// flag on one subtree; it is pushed down to the children on the way
+// through, before any rotation touches them.
+template <typename T>
+class SplaySequence {
+public:
+    SplaySequence() = default;
+
+    // Nodes in a pooled/huge-page arena, which split() pieces share
+    explicit SplaySequence(ArenaMode mode)
+        : tree(mode) {}
+
+    SplaySequence(SplaySequence&&) noexcept = default;
+    SplaySequence& operator=(SplaySequence&&) noexcept = default;
+
+    std::size_t size() const {
+        return tree.root ? tree.root->data.size : 0;
+    }
+
+    bool empty() const {
+        return !tree.root;
+    }
+
+    // Element at position i; throws std::out_of_range
+    T& at(std::size_t i) {
+        if (i >= size())
+            throw std::out_of_range("SplaySequence::at");
+        return nodeAt(i)->data.value;
+    }
+
+    // Insert so that value ends up at position i (0 <= i <= size())
+    void insertAt(std::size_t i, T value) {
+        if (i > size())
+            throw std::out_of_range("SplaySequence::insertAt");
+        Node* n = tree.createNode(Item(std::move(value)));
+
+        if (i == size()) {
+            if (Node* last = tree.root ? nodeAt(i - 1) : nullptr) {
+                n->left = last;
+                last->parent = n;
+            }
+        } else {
+            Node* next = nodeAt(i);
+            n->left = next->left;
+            if (n->left)
+                n->left->parent = n;
+            next->left = nullptr;
+            tree.refresh(next);
+            n->right = next;
+            next->parent = n;
+        }
+        tree.refresh(n);
+        tree.root = n;
+        ++tree.nodeCount;
+    }
+
+    void pushBack(T value) {
+        insertAt(size(), std::move(value));
+    }
+
+    void pushFront(T value) {
+        insertAt(0, std::move(value));
+    }
+
+    // Remove and return the element at position i
+    T eraseAt(std::size_t i) {
+        if (i >= size())
+            throw std::out_of_range("SplaySequence::eraseAt");
+        Node* x = nodeAt(i);
+        T out = std::move(x->data.value);
+
+        Node* left = x->left;
+        Node* right = x->right;
+        tree.destroyNode(x);
+        --tree.nodeCount;
+        ++tree.eraseEpoch;
+
+        tree.root = detach(left);
+        link(detach(right));
+        return out;
+    }
+
+    // Keep [0, i) and return [i, size()) as a new sequence
+    SplaySequence split(std::size_t i) {
+        SplaySequence rest;
+        rest.tree.arena = tree.arena;
+        if (i >= size())
+            return rest;
+
+        Node* x = nodeAt(i);
+        tree.root = detach(x->left);
+        x->left = nullptr;
+        tree.refresh(x);
+        rest.tree.root = x;
+
+        rest.tree.nodeCount = x->data.size;
+        tree.nodeCount = size();
+        ++tree.eraseEpoch;
+        return rest;
+    }
+
+    // Append other, leaving it empty. Nodes are adopted when both use the
+    // same allocator (always true for pieces from split); otherwise the
+    // elements are moved over.
+    void concat(SplaySequence& other) {
+        if (&other == this || other.empty()) return;
+
+        if (tree.arena == other.tree.arena) {
+            link(other.tree.root);
+            tree.nodeCount = size();
+            other.tree.root = nullptr;
+            other.tree.clear();
+            return;
+        }
+
+        other.forEach([&](T& v) {
+            pushBack(std::move(v));
+            return true;
+        });
+        other.tree.clear();
+    }
+
+    // Reverse positions [first, last)
+    void reverse(std::size_t first, std::size_t last) {
+        if (last > size() || first > last)
+            throw std::out_of_range("SplaySequence::reverse");
+        if (last - first < 2) return;
+
+        SplaySequence tail = split(last);
+        SplaySequence middle = split(first);
+        middle.tree.root->data.reversed ^= true;
+        concat(middle);
+        concat(tail);
+    }
+
+    // Visit elements in order until fn(value) returns false
+    template <typename Fn>
+    void forEach(Fn fn) {
+        std::vector<Node*> stack;
+        Node* n = tree.root;
+        while (n || !stack.empty()) {
+            for (; n; n = n->left) {
+                push(n);
+                stack.push_back(n);
+            }
+            n = stack.back();
+            stack.pop_back();
+            if (!fn(n->data.value))
+                return;
+            n = n->right;
+        }
+    }
+
+    std::vector<T> toVector() {
+        std::vector<T> out;
+        out.reserve(size());
+        forEach([&](const T& v) {
+            out.push_back(v);
+            return true;
+        });
+        return out;
+    }
+
+    void clear() {
+        tree.clear();
+    }
+
+private:
+    using Item = SequenceItem<T>;
+    using Tree = SplayTree<Item, std::less<Item>, SubtreeSize>;
+    using Node = typename Tree::Node;
+
+    Tree tree;
+
+    static std::size_t sizeOf(const Node* n) {
+        return n ? n->data.size : 0;
+    }
+
+    // Apply a pending reversal to n's children
+    static void push(Node* n) {
+        if (!n->data.reversed) return;
+        std::swap(n->left, n->right);
+        if (n->left) n->left->data.reversed ^= true;
+        if (n->right) n->right->data.reversed ^= true;
+        n->data.reversed = false;
+    }
+
+    // Descend by subtree sizes, pushing flags on the way so the splay
+    // only rotates settled nodes; x ends up at the root
+    Node* nodeAt(std::size_t i) {
+        Node* n = tree.root;
+        while (true) {
+            push(n);
+            std::size_t leftSize = sizeOf(n->left);
+            if (i < leftSize) {
+                n = n->left;
+            } else if (i == leftSize) {
+                break;
+            } else {
+                i -= leftSize + 1;
+                n = n->right;
+            }
+        }
+        tree.splay(n);
+        return n;
+    }
+
+    static Node* detach(Node* n) {
+        if (n) n->parent = nullptr;
+        return n;
+    }
+
+    // Hang a detached subtree after the current last element
+    void link(Node* right) {
+        if (!right) return;
+        if (!tree.root) {
+            tree.root = right;
+            return;
+        }
+        Node* last = nodeAt(size() - 1);
+        last->right = right;
+        right->parent = last;
+        tree.refresh(last);
+    }
+};
+
+#endif // SEQUENCE_HPP
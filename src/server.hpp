@@ -0,0 +1,638 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "protocol.hpp"
+#include "tree.hpp"
+
+// =======================
+// TreeMapServer
+// =======================
+
+// Single-threaded epoll server sharing one TreeMap between many clients.
+// Each loop iteration reads everything that is available, parses every
+// complete (pipelined) command into one batch, executes the batch against
+// the tree back to back, and then writes all replies. Parsed arguments
+// are views into the read buffers, so nothing is copied until a value is
+// stored in the tree. Replies go out with gathered writes, large values
+// straight from the strings the lookups returned.
+//
+// Per-connection buffers are bounded: a client whose replies pile up past
+// the output limit is not read from until it catches up, and a single
+// request larger than the input limit gets an error and is disconnected.
+class TreeMapServer {
+public:
+    struct Stats {
+        std::uint64_t connections = 0;
+        std::uint64_t commands = 0;
+        std::uint64_t batches = 0;
+        std::size_t largestBatch = 0;
+    };
+
+    explicit TreeMapServer(TreeMap& m)
+        : map(m) {
+        epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd < 0)
+            throw std::runtime_error(errorText("epoll_create1"));
+
+        wakeFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wakeFd < 0) {
+            ::close(epollFd);
+            throw std::runtime_error(errorText("eventfd"));
+        }
+        watch(wakeFd, EPOLLIN);
+    }
+
+    TreeMapServer(const TreeMapServer&) = delete;
+    TreeMapServer& operator=(const TreeMapServer&) = delete;
+
+    ~TreeMapServer() {
+        for (auto& [fd, conn] : connections)
+            ::close(fd);
+        for (int fd : listeners)
+            ::close(fd);
+        for (const std::string& path : unixPaths)
+            ::unlink(path.c_str());
+        ::close(wakeFd);
+        ::close(epollFd);
+    }
+
+    // Listen on host:port; port 0 picks a free port. Returns the bound port.
+    std::uint16_t listenTcp(std::uint16_t port, const std::string& host = "127.0.0.1") {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if (::inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1)
+            throw std::runtime_error("TreeMapServer: bad address " + host);
+
+        int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            throw std::runtime_error(errorText("socket"));
+        int one = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+            ::listen(fd, SOMAXCONN) < 0) {
+            std::string msg = errorText("bind/listen");
+            ::close(fd);
+            throw std::runtime_error(msg);
+        }
+
+        socklen_t len = sizeof(addr);
+        ::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+        addListener(fd);
+        return ntohs(addr.sin_port);
+    }
+
+    // Listen on a Unix domain socket, replacing any stale socket file
+    void listenUnix(const std::string& path) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path))
+            throw std::runtime_error("TreeMapServer: socket path too long");
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+        int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            throw std::runtime_error(errorText("socket"));
+
+        ::unlink(path.c_str());
+        if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+            ::listen(fd, SOMAXCONN) < 0) {
+            std::string msg = errorText("bind/listen");
+            ::close(fd);
+            throw std::runtime_error(msg);
+        }
+
+        unixPaths.push_back(path);
+        addListener(fd);
+    }
+
+    // Serve until stop() is called
+    void run() {
+        while (runOnce(-1)) {}
+    }
+
+    // One event-loop iteration, waiting at most timeoutMs (-1 = forever).
+    // Returns false once stop() has been requested.
+    bool runOnce(int timeoutMs) {
+        epoll_event events[kMaxEvents];
+        int n = ::epoll_wait(epollFd, events, kMaxEvents, timeoutMs);
+        if (n < 0) {
+            if (errno == EINTR) return !stopping.load();
+            throw std::runtime_error(errorText("epoll_wait"));
+        }
+
+        std::vector<Connection*> touched;
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            std::uint32_t ev = events[i].events;
+
+            if (fd == wakeFd) {
+                std::uint64_t drain;
+                while (::read(wakeFd, &drain, sizeof(drain)) > 0) {}
+                continue;
+            }
+            if (isListener(fd)) {
+                acceptAll(fd);
+                continue;
+            }
+
+            auto it = connections.find(fd);
+            if (it == connections.end()) continue;
+            Connection* conn = it->second.get();
+
+            if ((ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && accepting(*conn)) {
+                readAvailable(*conn);
+                parseAvailable(*conn);
+            }
+            touched.push_back(conn);
+        }
+
+        executeBatch();
+
+        for (Connection* conn : touched) {
+            conn->in.erase(0, conn->parsed);
+            conn->parsed = 0;
+            flush(*conn);
+            if (conn->closing && conn->out.empty())
+                closeConnection(conn->fd);
+        }
+
+        return !stopping.load();
+    }
+
+    // Safe to call from another thread or a signal handler
+    void stop() {
+        stopping.store(true);
+        std::uint64_t one = 1;
+        [[maybe_unused]] ssize_t n = ::write(wakeFd, &one, sizeof(one));
+    }
+
+    const Stats& stats() const {
+        return counters;
+    }
+
+    // Bytes of unparsed request / unsent replies allowed per connection
+    void setBufferLimits(std::size_t maxInputBytes, std::size_t maxOutputBytes) {
+        maxInput = std::max<std::size_t>(maxInputBytes, 1);
+        maxOutput = std::max<std::size_t>(maxOutputBytes, 1);
+    }
+
+    std::size_t connectionCount() const {
+        return connections.size();
+    }
+
+private:
+    static constexpr int kMaxEvents = 128;
+    static constexpr std::size_t kReadChunk = 64 * 1024;
+    static constexpr std::size_t kMaxIov = 64;
+    static constexpr std::size_t kDefaultBufferLimit = 64 * 1024 * 1024;
+    static constexpr std::size_t kMaxCursors = 4096;   // per connection
+
+    struct Connection {
+        int fd = -1;
+        std::string in;
+        std::size_t parsed = 0;   // bytes of `in` already turned into commands
+        ReplyBuffer out;
+        std::unique_ptr<ProtocolHandler> protocol;
+        bool closing = false;
+        bool quit = false;        // later commands in the batch are dropped
+        std::uint32_t events = 0; // current epoll interest
+
+        // SCAN handle -> resume key, private to this client
+        std::unordered_map<std::uint64_t, std::string> cursors;
+        std::deque<std::uint64_t> cursorOrder;   // oldest first
+        std::uint64_t lastCursor = 0;
+    };
+
+    struct Pending {
+        Connection* conn;
+        Command command;
+        std::string error;        // set when the input could not be parsed
+    };
+
+    TreeMap& map;
+    int epollFd = -1;
+    int wakeFd = -1;
+    std::vector<int> listeners;
+    std::vector<std::string> unixPaths;
+    std::unordered_map<int, std::unique_ptr<Connection>> connections;
+    std::vector<Pending> batch;
+    std::atomic<bool> stopping{false};
+    Stats counters;
+    std::size_t maxInput = kDefaultBufferLimit;
+    std::size_t maxOutput = kDefaultBufferLimit;
+
+    static std::string errorText(const char* what) {
+        return std::string("TreeMapServer: ") + what + ": " + std::strerror(errno);
+    }
+
+    void watch(int fd, std::uint32_t events) {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.fd = fd;
+        if (::epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) < 0)
+            throw std::runtime_error(errorText("epoll_ctl"));
+    }
+
+    void addListener(int fd) {
+        listeners.push_back(fd);
+        watch(fd, EPOLLIN);
+    }
+
+    bool isListener(int fd) const {
+        for (int l : listeners)
+            if (l == fd) return true;
+        return false;
+    }
+
+    void acceptAll(int listenFd) {
+        while (true) {
+            int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return; // EAGAIN, or a transient error we retry next time
+
+            int one = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // no-op on Unix sockets
+
+            auto conn = std::make_unique<Connection>();
+            conn->fd = fd;
+            conn->events = EPOLLIN | EPOLLRDHUP;
+            watch(fd, conn->events);
+            connections.emplace(fd, std::move(conn));
+            ++counters.connections;
+        }
+    }
+
+    // Still taking requests: not shutting down and not behind on replies
+    bool accepting(const Connection& conn) const {
+        return !conn.closing && conn.out.size() < maxOutput;
+    }
+
+    // Reads stop at the input limit; the rest stays in the socket
+    void readAvailable(Connection& conn) {
+        char buf[kReadChunk];
+        while (conn.in.size() < maxInput) {
+            ssize_t n = ::recv(conn.fd, buf, sizeof(buf), 0);
+            if (n > 0) {
+                conn.in.append(buf, static_cast<std::size_t>(n));
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                conn.closing = true;
+            return;
+        }
+    }
+
+    // RESP clients always open with an array ('*') and binary clients with
+    // the frame magic; anything else is treated as the line protocol
+    static std::unique_ptr<ProtocolHandler> detectProtocol(std::string_view firstBytes) {
+        if (!firstBytes.empty() && firstBytes[0] == '*')
+            return std::make_unique<RespProtocol>();
+        if (!firstBytes.empty() && static_cast<unsigned char>(firstBytes[0]) == BinaryProtocol::kMagic)
+            return std::make_unique<BinaryProtocol>();
+        return std::make_unique<TextProtocol>();
+    }
+
+    void parseAvailable(Connection& conn) {
+        if (conn.in.empty()) return;
+        if (!conn.protocol)
+            conn.protocol = detectProtocol(conn.in);
+
+        std::string_view input(conn.in);
+        while (conn.parsed < input.size()) {
+            Pending p{&conn, Command{}, {}};
+            std::size_t used = 0;
+            try {
+                used = conn.protocol->parse(input.substr(conn.parsed), p.command);
+            } catch (const ProtocolError& e) {
+                p.error = e.what();
+                batch.push_back(std::move(p));
+                conn.parsed = input.size();
+                conn.closing = true;
+                return;
+            }
+            if (used == 0) break;
+
+            conn.parsed += used;
+            batch.push_back(std::move(p));
+        }
+
+        // An incomplete request already at the limit can never finish
+        if (input.size() - conn.parsed >= maxInput) {
+            batch.push_back(Pending{&conn, Command{}, "request exceeds the input buffer limit"});
+            conn.parsed = input.size();
+            conn.closing = true;
+        }
+    }
+
+    static Reply keyArray(const std::vector<std::string>& keys) {
+        Reply r;
+        r.type = ReplyType::Array;
+        for (const std::string& k : keys)
+            r.elements.push_back(Reply::bulk(k));
+        return r;
+    }
+
+    // SCAN cursors are numeric handles for resume keys kept on the
+    // connection, since clients parse cursors as 64-bit integers. "0"
+    // starts and ends an iteration, as in Redis. Each connection keeps its
+    // newest kMaxCursors handles, so one client can't evict another's;
+    // using a dropped handle is an error.
+    static std::string saveCursor(Connection& conn, std::string key) {
+        if (conn.cursorOrder.size() == kMaxCursors) {
+            conn.cursors.erase(conn.cursorOrder.front());
+            conn.cursorOrder.pop_front();
+        }
+        std::uint64_t id = ++conn.lastCursor;
+        conn.cursors.emplace(id, std::move(key));
+        conn.cursorOrder.push_back(id);
+        return std::to_string(id);
+    }
+
+    static bool loadCursor(const Connection& conn, std::string_view cursor, std::string& key) {
+        key.clear();
+        if (cursor == "0") return true;
+        if (cursor.empty() || cursor.size() > 20) return false;
+        std::uint64_t id = 0;
+        for (char c : cursor) {
+            if (c < '0' || c > '9') return false;
+            id = id * 10 + static_cast<std::uint64_t>(c - '0');
+        }
+        auto it = conn.cursors.find(id);
+        if (it == conn.cursors.end()) return false;
+        key = it->second;
+        return true;
+    }
+
+    static bool parseCount(std::string_view text, long long& out) {
+        if (text.empty() || text.size() > 18) return false;
+        bool negative = text[0] == '-';
+        if (negative) text.remove_prefix(1);
+        if (text.empty()) return false;
+        long long v = 0;
+        for (char c : text) {
+            if (c < '0' || c > '9') return false;
+            v = v * 10 + (c - '0');
+        }
+        out = negative ? -v : v;
+        return true;
+    }
+
+    // SCAN cursor [COUNT n]
+    Reply scanCommand(Connection& conn, const Command& cmd) {
+        const auto& args = cmd.args;
+        if (args.empty()) return Reply::error("wrong number of arguments");
+
+        std::string from;
+        if (!loadCursor(conn, args[0], from)) return Reply::error("invalid cursor");
+
+        long long count = 10;
+        for (std::size_t i = 1; i + 1 < args.size(); i += 2) {
+            if (equalsIgnoreCase(args[i], "COUNT")) {
+                if (!parseCount(args[i + 1], count) || count < 1)
+                    return Reply::error("value is not an integer or out of range");
+            }
+        }
+
+        std::vector<std::string> keys;
+        std::string next;
+        bool more = false;
+        map.scanKeys(from, [&](const std::string& key) {
+            if (keys.size() == static_cast<std::size_t>(count)) {
+                next = key;
+                more = true;
+                return false;
+            }
+            keys.push_back(key);
+            return true;
+        });
+
+        Reply r;
+        r.type = ReplyType::Array;
+        r.elements.push_back(Reply::bulk(more ? saveCursor(conn, std::move(next)) : "0"));
+        r.elements.push_back(keyArray(keys));
+        return r;
+    }
+
+    // [ZRANGEBYLEX ignored-key] min max [LIMIT offset count], with Redis
+    // bound syntax: "-", "+", "[inclusive", "(exclusive"
+    Reply rangeByLexCommand(const Command& cmd) {
+        std::vector<std::string_view> args = cmd.args;
+        if (equalsIgnoreCase(cmd.name, "ZRANGEBYLEX") && !args.empty())
+            args.erase(args.begin());
+        if (args.size() != 2 && args.size() != 5)
+            return Reply::error("wrong number of arguments");
+
+        struct Bound {
+            bool unbounded;
+            bool inclusive;
+            std::string key;
+        };
+        auto parseBound = [](std::string_view b, bool low, Bound& out) {
+            if (b == "-" || b == "+") {
+                if ((b == "-") != low) return false;
+                out = Bound{true, true, {}};
+                return true;
+            }
+            if (b.empty() || (b[0] != '[' && b[0] != '(')) return false;
+            out = Bound{false, b[0] == '[', std::string(b.substr(1))};
+            return true;
+        };
+
+        Bound lo, hi;
+        if (!parseBound(args[0], true, lo) || !parseBound(args[1], false, hi))
+            return Reply::error("min or max not valid string range item");
+
+        long long offset = 0, limit = -1;
+        if (args.size() == 5) {
+            if (!equalsIgnoreCase(args[2], "LIMIT") || !parseCount(args[3], offset) ||
+                !parseCount(args[4], limit) || offset < 0)
+                return Reply::error("syntax error");
+        }
+
+        std::vector<std::string> keys;
+        map.scanKeys(lo.key, [&](const std::string& key) {
+            if (!lo.unbounded && !lo.inclusive && key == lo.key) return true;
+            if (!hi.unbounded && (hi.inclusive ? key > hi.key : key >= hi.key)) return false;
+            if (offset > 0) {
+                --offset;
+                return true;
+            }
+            if (limit >= 0 && keys.size() == static_cast<std::size_t>(limit)) return false;
+            keys.push_back(key);
+            return true;
+        });
+        return keyArray(keys);
+    }
+
+    Reply execute(const Command& cmd) {
+        const auto& args = cmd.args;
+        switch (cmd.type) {
+        case CommandType::Get: {
+            if (args.size() != 1) return Reply::error("wrong number of arguments");
+            auto value = map.find(std::string(args[0]));
+            return value ? Reply::bulk(std::move(*value)) : Reply::nil();
+        }
+        case CommandType::Set:
+            if (args.size() != 2) return Reply::error("wrong number of arguments");
+            map.insert(args[0], args[1]);
+            return Reply::status("OK");
+        case CommandType::Del: {
+            if (args.empty()) return Reply::error("wrong number of arguments");
+            long long removed = 0;
+            for (std::string_view key : args)
+                removed += map.deleteKey(std::string(key)) ? 1 : 0;
+            return Reply::number(removed);
+        }
+        case CommandType::MGet: {
+            if (args.empty()) return Reply::error("wrong number of arguments");
+            Reply r;
+            r.type = ReplyType::Array;
+            for (std::string_view key : args) {
+                auto value = map.find(std::string(key));
+                r.elements.push_back(value ? Reply::bulk(std::move(*value)) : Reply::nil());
+            }
+            return r;
+        }
+        case CommandType::MSet:
+            if (args.empty() || args.size() % 2 != 0) return Reply::error("wrong number of arguments");
+            for (std::size_t i = 0; i < args.size(); i += 2)
+                map.insert(args[i], args[i + 1]);
+            return Reply::status("OK");
+        case CommandType::RangeByLex:
+            return rangeByLexCommand(cmd);
+        case CommandType::DbSize:
+            return Reply::number(static_cast<long long>(map.size()));
+        case CommandType::Ping:
+            return args.empty() ? Reply::status("PONG") : Reply::bulk(std::string(args[0]));
+        case CommandType::Scan:
+        case CommandType::Hello:
+        case CommandType::CommandDocs:
+            break; // need the connection; handled in executeBatch
+        case CommandType::Quit:
+            return Reply::status("BYE");
+        case CommandType::Unknown:
+            break;
+        }
+        return Reply::error("unknown command '" + std::string(cmd.name) + "'");
+    }
+
+    // HELLO [protover]: switch RESP version and describe the server
+    Reply hello(Connection& conn, const Command& cmd) {
+        if (!cmd.args.empty()) {
+            long long version = 0;
+            if (!parseCount(cmd.args[0], version) || !conn.protocol->negotiate(static_cast<int>(version)))
+                return Reply::error("NOPROTO unsupported protocol version");
+        }
+
+        Reply r;
+        r.type = ReplyType::Map;
+        r.elements.push_back(Reply::bulk("server"));
+        r.elements.push_back(Reply::bulk("treemap"));
+        r.elements.push_back(Reply::bulk("proto"));
+        r.elements.push_back(Reply::number(conn.protocol->protocolVersion()));
+        r.elements.push_back(Reply::bulk("keys"));
+        r.elements.push_back(Reply::number(static_cast<long long>(map.size())));
+        return r;
+    }
+
+    // Run everything parsed this iteration against the tree, in arrival
+    // order, then queue the replies
+    void executeBatch() {
+        if (batch.empty()) return;
+
+        for (Pending& p : batch) {
+            if (p.conn->quit) continue;
+            Reply reply;
+            if (!p.error.empty())
+                reply = Reply::error(p.error);
+            else if (p.command.type == CommandType::Scan)
+                reply = scanCommand(*p.conn, p.command);
+            else if (p.command.type == CommandType::Hello)
+                reply = hello(*p.conn, p.command);
+            else if (p.command.type == CommandType::CommandDocs)
+                reply.type = ReplyType::Array; // no command docs; keeps redis-cli happy
+            else
+                reply = execute(p.command);
+            p.conn->protocol->encode(reply, p.conn->out);
+            if (p.command.type == CommandType::Quit) {
+                p.conn->quit = true;
+                p.conn->closing = true;
+            }
+        }
+
+        counters.commands += batch.size();
+        ++counters.batches;
+        if (batch.size() > counters.largestBatch)
+            counters.largestBatch = batch.size();
+        batch.clear();
+    }
+
+    // Gathered writes straight from the reply segments (sendmsg rather
+    // than writev, for MSG_NOSIGNAL)
+    void flush(Connection& conn) {
+        while (!conn.out.empty()) {
+            iovec parts[kMaxIov];
+            msghdr msg{};
+            msg.msg_iov = parts;
+            msg.msg_iovlen = conn.out.gather(parts, kMaxIov);
+
+            ssize_t n = ::sendmsg(conn.fd, &msg, MSG_NOSIGNAL);
+            if (n > 0) {
+                conn.out.consume(static_cast<std::size_t>(n));
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            conn.out.clear(); // peer is gone
+            conn.closing = true;
+            return;
+        }
+        updateInterest(conn);
+    }
+
+    // Level-triggered, so only ask for what we will act on: no reads (and
+    // no hang-up reports) while closing or behind on replies, writes only
+    // while replies are queued
+    void updateInterest(Connection& conn) {
+        std::uint32_t want = (accepting(conn) ? EPOLLIN | EPOLLRDHUP : 0u) |
+                             (conn.out.empty() ? 0u : EPOLLOUT);
+        if (want == conn.events) return;
+        epoll_event ev{};
+        ev.events = want;
+        ev.data.fd = conn.fd;
+        ::epoll_ctl(epollFd, EPOLL_CTL_MOD, conn.fd, &ev);
+        conn.events = want;
+    }
+
+    void closeConnection(int fd) {
+        ::epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        ::close(fd);
+        connections.erase(fd);
+    }
+};
+
+#endif // SERVER_HPP
@@ -0,0 +1,316 @@
+#ifndef SHARDED_MAP_HPP
+#define SHARDED_MAP_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "tree.hpp"
+
+// =======================
+// DelegationQueue
+// =======================
+
+// A unit of work run on a shard's owner thread
+struct DelegatedTask {
+    std::atomic<DelegatedTask*> next{nullptr};
+
+    virtual ~DelegatedTask() = default;
+    virtual void run(TreeMap& map) = 0;
+};
+
+// Intrusive lock-free multi-producer/single-consumer queue (Vyukov):
+// a push is one exchange plus one store, a pop touches only the consumer's
+// end unless the queue is nearly empty. pop() may return nullptr while a
+// push is halfway done; the consumer simply tries again later.
+class DelegationQueue {
+public:
+    DelegationQueue()
+        : head(&stub), tail(&stub) {}
+
+    DelegationQueue(const DelegationQueue&) = delete;
+    DelegationQueue& operator=(const DelegationQueue&) = delete;
+
+    // Any thread
+    void push(DelegatedTask* task) {
+        task->next.store(nullptr, std::memory_order_relaxed);
+        DelegatedTask* prev = head.exchange(task, std::memory_order_acq_rel);
+        prev->next.store(task, std::memory_order_release);
+    }
+
+    // Owner thread only
+    DelegatedTask* pop() {
+        DelegatedTask* t = tail;
+        DelegatedTask* next = t->next.load(std::memory_order_acquire);
+        if (t == &stub) {
+            if (!next) return nullptr;
+            tail = next;
+            t = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next) {
+            tail = next;
+            return t;
+        }
+        if (t != head.load(std::memory_order_acquire))
+            return nullptr; // a producer is between its two steps
+        push(&stub);
+        next = t->next.load(std::memory_order_acquire);
+        if (next) {
+            tail = next;
+            return t;
+        }
+        return nullptr;
+    }
+
+private:
+    struct Stub : DelegatedTask {
+        void run(TreeMap&) override {}
+    };
+
+    alignas(64) std::atomic<DelegatedTask*> head;   // producers
+    alignas(64) DelegatedTask* tail;                // consumer
+    Stub stub;
+};
+
+// =======================
+// ShardedTreeMap
+// =======================
+
+struct ShardedStats {
+    std::uint64_t operations = 0;
+    std::uint64_t batches = 0;      // owner wake-ups that ran something
+    std::uint64_t largestBatch = 0;
+};
+
+// Shard-per-core TreeMap. Keys are hashed to shards; each shard's map is
+// touched only by its owner thread, so splaying needs no locks and the
+// tree never bounces between caches. Other threads delegate operations
+// through the shard's MPSC queue and get a std::future back (or, with
+// post(), have a callback run on the owner). Owners dequeue in batches of
+// up to kBatch, spin briefly when idle and then sleep on an atomic wait.
+//
+// Keys are spread by hash, so there is no cross-shard key order: range
+// scans have to go through submit() on every shard and merge.
+class ShardedTreeMap {
+public:
+    static constexpr std::size_t kBatch = 64;
+    static constexpr std::size_t kIdleSpins = 2048;
+
+    // pinThreads binds shard i's owner to CPU i (mod the CPU count)
+    explicit ShardedTreeMap(std::size_t shards = std::max(1u, std::thread::hardware_concurrency()),
+                            bool pinThreads = false, ArenaMode mode = ArenaMode::Heap) {
+        shards = std::max<std::size_t>(shards, 1);
+        for (std::size_t i = 0; i < shards; ++i)
+            shardList.push_back(std::make_unique<Shard>(mode));
+        for (std::size_t i = 0; i < shards; ++i)
+            shardList[i]->owner = std::thread([this, i, pinThreads] { ownerLoop(*shardList[i], i, pinThreads); });
+    }
+
+    ShardedTreeMap(const ShardedTreeMap&) = delete;
+    ShardedTreeMap& operator=(const ShardedTreeMap&) = delete;
+
+    // Runs everything already submitted, then stops the owners
+    ~ShardedTreeMap() {
+        for (auto& s : shardList) {
+            s->stopping.store(true, std::memory_order_seq_cst);
+            wake(*s);
+        }
+        for (auto& s : shardList)
+            s->owner.join();
+    }
+
+    std::future<std::optional<std::string>> find(std::string_view key) {
+        return submit(key, [k = std::string(key)](TreeMap& m) { return m.find(k); });
+    }
+
+    std::future<void> insert(std::string_view key, std::string_view value) {
+        return submit(key, [k = std::string(key), v = std::string(value)](TreeMap& m) { m.insert(k, v); });
+    }
+
+    std::future<bool> deleteKey(std::string_view key) {
+        return submit(key, [k = std::string(key)](TreeMap& m) { return m.deleteKey(k); });
+    }
+
+    // Run fn(map) on the owner of key's shard; the future carries its
+    // result or exception. fn must not block on this ShardedTreeMap.
+    template <typename Fn>
+    std::future<std::invoke_result_t<Fn&, TreeMap&>> submit(std::string_view key, Fn fn) {
+        return submitTo(shardFor(key), std::move(fn));
+    }
+
+    // Same, on shard number `shard` (e.g. to visit every shard)
+    template <typename Fn>
+    std::future<std::invoke_result_t<Fn&, TreeMap&>> submitTo(std::size_t shard, Fn fn) {
+        using R = std::invoke_result_t<Fn&, TreeMap&>;
+        std::promise<R> promise;
+        std::future<R> future = promise.get_future();
+        auto task = [fn = std::move(fn), promise = std::move(promise)](TreeMap& m) mutable {
+            try {
+                if constexpr (std::is_void_v<R>) {
+                    fn(m);
+                    promise.set_value();
+                } else {
+                    promise.set_value(fn(m));
+                }
+            } catch (...) {
+                promise.set_exception(std::current_exception());
+            }
+        };
+        enqueue(*shardList[shard], std::move(task));
+        return future;
+    }
+
+    // Fire and forget: callback(map) runs on the owner thread. Exceptions
+    // it throws are dropped.
+    template <typename Fn>
+    void post(std::string_view key, Fn callback) {
+        enqueue(*shardList[shardFor(key)], [callback = std::move(callback)](TreeMap& m) mutable {
+            try {
+                callback(m);
+            } catch (...) {
+            }
+        });
+    }
+
+    // Entries across all shards (waits for every owner)
+    std::size_t size() {
+        std::vector<std::future<std::size_t>> parts;
+        for (std::size_t i = 0; i < shardList.size(); ++i)
+            parts.push_back(submitTo(i, [](TreeMap& m) { return m.size(); }));
+        std::size_t total = 0;
+        for (auto& p : parts)
+            total += p.get();
+        return total;
+    }
+
+    std::size_t shardCount() const {
+        return shardList.size();
+    }
+
+    std::size_t shardFor(std::string_view key) const {
+        return std::hash<std::string_view>{}(key) % shardList.size();
+    }
+
+    ShardedStats stats() const {
+        ShardedStats total;
+        for (const auto& s : shardList) {
+            total.operations += s->operations.load(std::memory_order_relaxed);
+            total.batches += s->batches.load(std::memory_order_relaxed);
+            total.largestBatch = std::max<std::uint64_t>(total.largestBatch, s->largestBatch.load(std::memory_order_relaxed));
+        }
+        return total;
+    }
+
+private:
+    template <typename Fn>
+    struct Task : DelegatedTask {
+        Fn fn;
+
+        explicit Task(Fn f)
+            : fn(std::move(f)) {}
+
+        void run(TreeMap& map) override {
+            fn(map);
+        }
+    };
+
+    struct Shard {
+        TreeMap map;
+        DelegationQueue queue;
+        std::thread owner;
+
+        // Sleep/wake handshake: producers bump `pending` after pushing and
+        // only touch `wakeups` when the owner has announced it is idle
+        alignas(64) std::atomic<std::size_t> pending{0};
+        std::atomic<bool> idle{false};
+        std::atomic<std::uint32_t> wakeups{0};
+        std::atomic<bool> stopping{false};
+
+        alignas(64) std::atomic<std::uint64_t> operations{0};
+        std::atomic<std::uint64_t> batches{0};
+        std::atomic<std::uint64_t> largestBatch{0};
+
+        explicit Shard(ArenaMode mode)
+            : map(mode) {}
+    };
+
+    std::vector<std::unique_ptr<Shard>> shardList;
+
+    template <typename Fn>
+    void enqueue(Shard& s, Fn&& fn) {
+        s.queue.push(new Task<std::decay_t<Fn>>(std::forward<Fn>(fn)));
+        s.pending.fetch_add(1, std::memory_order_seq_cst);
+        if (s.idle.load(std::memory_order_seq_cst))
+            wake(s);
+    }
+
+    static void wake(Shard& s) {
+        s.wakeups.fetch_add(1, std::memory_order_seq_cst);
+        s.wakeups.notify_one();
+    }
+
+    static void ownerLoop(Shard& s, std::size_t index, bool pin) {
+        if (pin) {
+            unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(index % cpus, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set); // best effort
+        }
+
+        std::size_t idleSpins = 0;
+        while (true) {
+            std::size_t ran = 0;
+            while (ran < kBatch) {
+                DelegatedTask* t = s.queue.pop();
+                if (!t) break;
+                t->run(s.map);
+                delete t;
+                ++ran;
+            }
+
+            if (ran) {
+                s.pending.fetch_sub(ran, std::memory_order_relaxed);
+                s.operations.fetch_add(ran, std::memory_order_relaxed);
+                s.batches.fetch_add(1, std::memory_order_relaxed);
+                if (ran > s.largestBatch.load(std::memory_order_relaxed))
+                    s.largestBatch.store(ran, std::memory_order_relaxed);
+                idleSpins = 0;
+                continue;
+            }
+
+            bool empty = s.pending.load(std::memory_order_seq_cst) == 0;
+            if (empty && s.stopping.load(std::memory_order_seq_cst))
+                return;
+            if (!empty || ++idleSpins < kIdleSpins)
+                continue; // work is arriving, or worth spinning for
+
+            // Announce idleness before the last check, so a producer either
+            // sees it and wakes us or its task is seen here
+            s.idle.store(true, std::memory_order_seq_cst);
+            std::uint32_t seen = s.wakeups.load(std::memory_order_seq_cst);
+            if (s.pending.load(std::memory_order_seq_cst) == 0 && !s.stopping.load(std::memory_order_seq_cst))
+                s.wakeups.wait(seen, std::memory_order_seq_cst);
+            s.idle.store(false, std::memory_order_relaxed);
+            idleSpins = 0;
+        }
+    }
+};
+
+#endif // SHARDED_MAP_HPP
@@ -1,37 +1,109 @@
 #ifndef TREEMAP_HPP
 #define TREEMAP_HPP
 
+#include <cstddef>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "arena.hpp"
+#include "change_stream.hpp"
+#include "codec.hpp"
+#include "cold_store.hpp"
+#include "hot_keys.hpp"
+#include "key_order.hpp"
 
 // =======================
 // KeyValuePair
 // =======================
 
+// Per-entry state only some maps use. It lives out of line and is
+// allocated only while a feature needs it, so an entry of a plain map
+// pays a single null pointer for it.
+struct EntryExtras {
+    // Normalized key when the map has a KeyNormalizer (which may map a
+    // key to ""); unset means key itself is the sort key
+    std::optional<std::string> sortKey;
+
+    // Range-hash augmentation, maintained once TreeMap::enableRangeHashing
+    // is on: this entry's hash, and the sum of hashes and count of entries
+    // in its subtree
+    std::uint64_t entryHash = 0;
+    std::uint64_t subtreeHash = 0;
+    std::size_t subtreeCount = 1;
+};
+
 class KeyValuePair {
 public:
     std::string key;
     std::string value;
+    std::unique_ptr<EntryExtras> extras;
+    bool compressed = false; // value holds codec output, not the raw bytes
+    bool cold = false;       // value holds an encoded ColdLocator
 
     KeyValuePair() = default;
 
-    KeyValuePair(const std::string& k, const std::string& v = "")
+    KeyValuePair(std::string_view k, std::string_view v = {})
         : key(k), value(v) {}
 
-    // Compare ONLY by key
+    KeyValuePair(const KeyValuePair& other)
+        : key(other.key),
+          value(other.value),
+          extras(other.extras ? std::make_unique<EntryExtras>(*other.extras) : nullptr),
+          compressed(other.compressed),
+          cold(other.cold) {}
+
+    KeyValuePair(KeyValuePair&&) noexcept = default;
+
+    KeyValuePair& operator=(const KeyValuePair& other) {
+        if (this != &other)
+            *this = KeyValuePair(other);
+        return *this;
+    }
+
+    KeyValuePair& operator=(KeyValuePair&&) noexcept = default;
+
+    EntryExtras& ensureExtras() {
+        if (!extras)
+            extras = std::make_unique<EntryExtras>();
+        return *extras;
+    }
+
+    const std::string* sortKey() const {
+        return extras && extras->sortKey ? &*extras->sortKey : nullptr;
+    }
+
+    void setSortKey(std::string sortKey) {
+        ensureExtras().sortKey = std::move(sortKey);
+    }
+
+    const std::string& orderKey() const {
+        const std::string* sk = sortKey();
+        return sk ? *sk : key;
+    }
+
+    // Compare ONLY by (sort) key
     bool operator<(const KeyValuePair& other) const {
-        return key < other.key;
+        return orderKey() < other.orderKey();
     }
     bool operator>(const KeyValuePair& other) const {
-        return key > other.key;
+        return orderKey() > other.orderKey();
     }
     bool operator<=(const KeyValuePair& other) const {
-        return key <= other.key;
+        return orderKey() <= other.orderKey();
     }
     bool operator>=(const KeyValuePair& other) const {
-        return key >= other.key;
+        return orderKey() >= other.orderKey();
     }
     bool operator==(const KeyValuePair& other) const {
-        return key == other.key;
+        return orderKey() == other.orderKey();
     }
 };
 
@@ -39,7 +111,28 @@ public:
 // SplayTree<T>
 // =======================
 
-template <typename T>
+// Subtree augmentation hook. A policy with enabled = true is called as
+// augment(data, leftData, rightData) (children may be null) whenever a
+// node's subtree changes, bottom-up, so data can cache a summary of its
+// subtree (e.g. IntervalMap's max endpoint).
+struct NoAugment {
+    static constexpr bool enabled = false;
+
+    template <typename T>
+    void operator()(T&, const T*, const T*) const {}
+};
+
+// How lookups restructure the tree. Inserts of new keys and erases always
+// splay; the policy decides what finding an existing position does.
+enum class SplayPolicy {
+    Full,       // splay the accessed node to the root (classic)
+    Semi,       // semi-splay: about half the restructuring per access
+    None,       // plain BST lookups; shape only changes on writes
+    Adaptive    // switch between the three from measured locality
+};
+
+// Compare is a strict weak order on T; every descent goes through it
+template <typename T, typename Compare = std::less<T>, typename Augment = NoAugment>
 class SplayTree {
 private:
     struct Node {
@@ -50,14 +143,68 @@ private:
 
         Node(const T& d)
             : data(d), left(nullptr), right(nullptr), parent(nullptr) {}
+
+        Node(T&& d)
+            : data(std::move(d)), left(nullptr), right(nullptr), parent(nullptr) {}
     };
 
     Node* root = nullptr;
+    std::size_t nodeCount = 0;
+    Compare less;
+    [[no_unique_address]] Augment augment;
+
+    // Null when nodes come straight from new/delete (ArenaMode::Heap)
+    std::shared_ptr<NodeArena> arena;
+
+    // Incremental defragmentation state. Erasing a node bumps eraseEpoch,
+    // which invalidates a pass that is still holding node pointers.
+    std::vector<Node*> defragOrder;
+    std::vector<std::size_t> slotOrder;   // arena slot -> pending defragOrder index
+    std::size_t defragPos = 0;
+    std::uint64_t eraseEpoch = 0;
+    std::uint64_t defragEpoch = 0;
+
+    // Lookup policy; under Adaptive, mode is what the sampler last chose
+    SplayPolicy policy = SplayPolicy::Full;
+    SplayPolicy mode = SplayPolicy::Full;
+
+    // Adaptive sampling: every kSampleEvery-th access records its depth and
+    // whether its node was among the last kRecent sampled ones (reuse)
+    static constexpr std::size_t kSampleEvery = 8;
+    static constexpr std::size_t kWindow = 256;
+    static constexpr std::size_t kRecent = 16;
+    std::size_t accessTick = 0;
+    std::size_t samples = 0;
+    std::size_t reuseHits = 0;
+    std::size_t depthSum = 0;
+    std::size_t pendingVotes = 0;          // consecutive windows agreeing
+    SplayPolicy pendingMode = SplayPolicy::Full;
+    const Node* recent[kRecent] = {};
+    std::size_t recentPos = 0;
 
     // Allow TreeMap to see Node when it uses findNode(...)
-    template <typename U>
+    template <typename U, typename C, typename A>
     friend class SplayTree; // (needed by template rules, harmless)
     friend class TreeMap;
+    template <typename K, typename V>
+    friend class IntervalMap;
+    template <typename U>
+    friend class SplaySequence;
+
+    // ---- augmentation ----
+
+    void refresh(Node* x) {
+        if constexpr (Augment::enabled)
+            augment(x->data, x->left ? &x->left->data : nullptr,
+                    x->right ? &x->right->data : nullptr);
+    }
+
+    // After x's subtree changed without rotations: x and its ancestors
+    void refreshUp(Node* x) {
+        if constexpr (Augment::enabled)
+            for (; x; x = x->parent)
+                refresh(x);
+    }
 
     // ---- rotations ----
 
@@ -80,6 +227,9 @@ private:
 
         y->left = x;
         x->parent = y;
+
+        refresh(x);
+        refresh(y);
     }
 
     void rotateRight(Node* x) {
@@ -101,6 +251,9 @@ private:
 
         y->right = x;
         x->parent = y;
+
+        refresh(x);
+        refresh(y);
     }
 
     void splay(Node* x) {
@@ -139,6 +292,247 @@ private:
         }
     }
 
+    // Semi-splaying: a zig-zig rotates only the parent over the
+    // grandparent and continues from the parent, roughly halving the
+    // depth of the path instead of inverting it
+    void semiSplay(Node* x) {
+        while (x && x->parent) {
+            Node* p = x->parent;
+            Node* g = p->parent;
+            if (!g) {
+                if (x == p->left)
+                    rotateRight(p);
+                else
+                    rotateLeft(p);
+                return;
+            }
+            if (x == p->left && p == g->left) {
+                rotateRight(g);
+                x = p;
+            } else if (x == p->right && p == g->right) {
+                rotateLeft(g);
+                x = p;
+            } else if (x == p->left) {
+                rotateRight(p);
+                rotateLeft(g);
+            } else {
+                rotateLeft(p);
+                rotateRight(g);
+            }
+        }
+    }
+
+    // A lookup reached x at the given depth: restructure per policy
+    void accessed(Node* x, std::size_t depth) {
+        if (!x) return;
+        if (policy == SplayPolicy::Adaptive && ++accessTick % kSampleEvery == 0)
+            sample(x, depth);
+
+        switch (mode) {
+        case SplayPolicy::Full:
+            splay(x);
+            break;
+        case SplayPolicy::Semi:
+            semiSplay(x);
+            break;
+        case SplayPolicy::None:
+        case SplayPolicy::Adaptive:
+            break;
+        }
+    }
+
+    void sample(const Node* x, std::size_t depth) {
+        depthSum += depth;
+        for (const Node* r : recent)
+            if (r == x) {
+                ++reuseHits;
+                break;
+            }
+        recent[recentPos++ % kRecent] = x;
+        if (++samples < kWindow) return;
+
+        // High reuse means skewed traffic that splaying turns into shallow
+        // hits; low reuse means uniform traffic where it only costs
+        // rotations. The bands overlap so a borderline load does not flap.
+        double reuse = static_cast<double>(reuseHits) / static_cast<double>(samples);
+        double avgDepth = static_cast<double>(depthSum) / static_cast<double>(samples);
+        SplayPolicy want = mode;
+        switch (mode) {
+        case SplayPolicy::Full:
+            if (reuse < 0.25) want = SplayPolicy::Semi;
+            break;
+        case SplayPolicy::Semi:
+            if (reuse >= 0.5) want = SplayPolicy::Full;
+            else if (reuse < 0.05) want = SplayPolicy::None;
+            break;
+        default:
+            if (reuse >= 0.15) want = SplayPolicy::Semi;
+            break;
+        }
+
+        std::size_t logSize = 1;
+        while ((std::size_t{1} << logSize) < nodeCount)
+            ++logSize;
+        bool deep = avgDepth > 2.0 * static_cast<double>(logSize) + 2.0;
+
+        pendingVotes = want == pendingMode ? pendingVotes + 1 : 1;
+        pendingMode = want;
+        if (want != mode && pendingVotes >= 2) {
+            mode = want;
+            pendingVotes = 0;
+            if (mode == SplayPolicy::None)
+                rebalance(); // no more splaying to fix the shape later
+        } else if (mode == SplayPolicy::None && deep) {
+            rebalance(); // writes have skewed the shape since
+        }
+
+        samples = reuseHits = depthSum = 0;
+    }
+
+    // ---- allocation ----
+
+    // U is T or const T&, so callers holding an rvalue don't copy
+    template <typename U>
+    Node* createNode(U&& value) {
+        if (!arena)
+            return new Node(std::forward<U>(value));
+
+        void* slot = arena->allocate();
+        try {
+            return new (slot) Node(std::forward<U>(value));
+        } catch (...) {
+            arena->deallocate(slot);
+            throw;
+        }
+    }
+
+    void destroyNode(Node* node) {
+        if (!arena) {
+            delete node;
+            return;
+        }
+        node->~Node();
+        arena->deallocate(node);
+    }
+
+    // Move a node's contents into `slot` (a new heap node when null) and
+    // re-point every link that referred to the old address.
+    Node* relocateNode(Node* old, void* slot) {
+        Node* fresh;
+        if (slot) {
+            try {
+                fresh = new (slot) Node(std::move(old->data));
+            } catch (...) {
+                arena->deallocate(slot);
+                throw;
+            }
+        } else {
+            fresh = new Node(std::move(old->data));
+        }
+
+        fresh->left = old->left;
+        fresh->right = old->right;
+        fresh->parent = old->parent;
+
+        if (fresh->left)
+            fresh->left->parent = fresh;
+        if (fresh->right)
+            fresh->right->parent = fresh;
+
+        if (!old->parent)
+            root = fresh;
+        else if (old == old->parent->left)
+            old->parent->left = fresh;
+        else
+            old->parent->right = fresh;
+
+        destroyNode(old);
+        return fresh;
+    }
+
+    // A private arena is compacted: the i-th node of a pass goes to arena
+    // slot i, so a finished pass leaves the nodes packed at the front in
+    // relocation order and the chunks behind them empty. A shared arena
+    // (SplaySequence pieces) only lets nodes move into lower free slots.
+    bool compacting() const {
+        return arena && arena.use_count() == 1;
+    }
+
+    void placeNext() {
+        std::size_t target = defragPos;
+        Node* n = defragOrder[defragPos++];
+        if (!arena) {
+            relocateNode(n, nullptr);
+            return;
+        }
+
+        if (!compacting()) {
+            void* slot = arena->allocate();
+            if (arena->slotIndex(slot) < arena->slotIndex(n))
+                relocateNode(n, slot);
+            else
+                arena->deallocate(slot);
+            return;
+        }
+
+        std::size_t from = arena->slotIndex(n);
+        slotOrder[from] = NodeArena::npos;
+        if (from == target) return;
+
+        // Slots below target hold placed nodes, so whatever sits in target
+        // is pending or new; move it to the lowest free slot past it
+        if (arena->slotLive(target)) {
+            void* spare = arena->allocate();
+            std::size_t to = arena->slotIndex(spare);
+            slotOrder.resize(arena->slotCount(), NodeArena::npos);
+            Node* displaced = relocateNode(static_cast<Node*>(arena->slotAddress(target)), spare);
+            if (std::size_t idx = std::exchange(slotOrder[target], NodeArena::npos); idx != NodeArena::npos) {
+                defragOrder[idx] = displaced;
+                slotOrder[to] = idx;
+            }
+        }
+        relocateNode(n, arena->allocateAt(target));
+    }
+
+    // Relocation order: the top hotLevels levels breadth-first, then each
+    // subtree below them in pre-order so it occupies one contiguous run.
+    void buildDefragOrder(std::size_t hotLevels) {
+        defragOrder.clear();
+        defragPos = 0;
+        defragEpoch = eraseEpoch;
+        if (!root) return;
+
+        std::vector<Node*> level{root};
+        std::vector<Node*> next;
+        for (std::size_t depth = 0; depth < hotLevels && !level.empty(); ++depth) {
+            next.clear();
+            for (Node* n : level) {
+                defragOrder.push_back(n);
+                if (n->left) next.push_back(n->left);
+                if (n->right) next.push_back(n->right);
+            }
+            level.swap(next);
+        }
+
+        std::vector<Node*> stack;
+        for (Node* subtree : level) {
+            stack.push_back(subtree);
+            while (!stack.empty()) {
+                Node* n = stack.back();
+                stack.pop_back();
+                defragOrder.push_back(n);
+                if (n->right) stack.push_back(n->right);
+                if (n->left) stack.push_back(n->left);
+            }
+        }
+
+        if (compacting()) {
+            slotOrder.assign(arena->slotCount(), NodeArena::npos);
+            for (std::size_t i = 0; i < defragOrder.size(); ++i)
+                slotOrder[arena->slotIndex(defragOrder[i])] = i;
+        }
+    }
+
     // ---- helpers ----
 
     Node* subtreeMin(Node* x) const {
@@ -148,6 +542,13 @@ private:
         return x;
     }
 
+    Node* subtreeMax(Node* x) const {
+        if (!x) return nullptr;
+        while (x->right)
+            x = x->right;
+        return x;
+    }
+
     void replaceNode(Node* u, Node* v) {
         if (!u->parent)
             root = v;
@@ -160,146 +561,1355 @@ private:
             v->parent = u->parent;
     }
 
+    // Unlink and free a node; it is splayed to the root first
+    void eraseNode(Node* node) {
+        splay(node);
+
+        if (!node->left) {
+            replaceNode(node, node->right);
+        } else if (!node->right) {
+            replaceNode(node, node->left);
+        } else {
+            Node* minRight = subtreeMin(node->right);
+            Node* changed = minRight;
+            if (minRight->parent != node) {
+                changed = minRight->parent;
+                replaceNode(minRight, minRight->right);
+                minRight->right = node->right;
+                minRight->right->parent = minRight;
+            }
+            replaceNode(node, minRight);
+            minRight->left = node->left;
+            minRight->left->parent = minRight;
+            refreshUp(changed);
+        }
+
+        destroyNode(node);
+        --nodeCount;
+        ++eraseEpoch;
+    }
+
+    // Perfectly balanced subtree over nodes[lo, hi), already in order
+    Node* build(std::vector<Node*>& nodes, std::size_t lo, std::size_t hi, Node* parent) {
+        if (lo >= hi) return nullptr;
+        std::size_t mid = lo + (hi - lo) / 2;
+        Node* n = nodes[mid];
+        n->parent = parent;
+        n->left = build(nodes, lo, mid, n);
+        n->right = build(nodes, mid + 1, hi, n);
+        refresh(n);
+        return n;
+    }
+
+    // Pop helper: `top` points into the root node (or is null)
+    std::optional<T> popRoot(const T* top) {
+        if (!top) return std::nullopt;
+        std::optional<T> out(std::move(root->data));
+        eraseNode(root);
+        return out;
+    }
+
     void clear(Node* node) {
         if (!node) return;
         clear(node->left);
         clear(node->right);
-        delete node;
+        destroyNode(node);
     }
 
 public:
     SplayTree() = default;
 
+    explicit SplayTree(Compare cmp)
+        : less(std::move(cmp)) {}
+
+    explicit SplayTree(ArenaMode mode, Compare cmp = Compare())
+        : less(std::move(cmp)) {
+        if (mode != ArenaMode::Heap)
+            arena = std::make_shared<NodeArena>(sizeof(Node), alignof(Node),
+                                                mode == ArenaMode::HugePages);
+    }
+
     ~SplayTree() {
         clear(root);
     }
 
+    // Nodes are owned through raw links, so the tree moves but never copies
+    SplayTree(const SplayTree&) = delete;
+    SplayTree& operator=(const SplayTree&) = delete;
+
+    SplayTree(SplayTree&& other) noexcept
+        : root(std::exchange(other.root, nullptr)),
+          nodeCount(std::exchange(other.nodeCount, 0)),
+          less(std::move(other.less)),
+          augment(std::move(other.augment)),
+          arena(std::move(other.arena)),
+          policy(other.policy),
+          mode(other.mode) {
+        other.clear();
+    }
+
+    SplayTree& operator=(SplayTree&& other) noexcept {
+        if (this != &other) {
+            clear();
+            std::swap(root, other.root);
+            std::swap(nodeCount, other.nodeCount);
+            std::swap(less, other.less);
+            std::swap(augment, other.augment);
+            std::swap(arena, other.arena);
+            std::swap(policy, other.policy);
+            std::swap(mode, other.mode);
+            other.clear();
+        }
+        return *this;
+    }
+
+    // Remove every node
+    void clear() {
+        clear(root);
+        root = nullptr;
+        nodeCount = 0;
+        defragOrder.clear();
+        slotOrder.clear();
+        defragPos = 0;
+        ++eraseEpoch;
+        if (arena)
+            arena->releaseEmptyChunks();
+    }
+
     // Insert: BST insert + splay inserted node
     void insert(const T& value) {
         if (!root) {
-            root = new Node(value);
+            root = createNode(value);
+            ++nodeCount;
             return;
         }
 
         Node* cur = root;
         Node* parent = nullptr;
+        std::size_t depth = 0;
 
         while (cur) {
             parent = cur;
-            if (value < cur->data)
+            if (less(value, cur->data))
                 cur = cur->left;
-            else if (value > cur->data)
+            else if (less(cur->data, value))
                 cur = cur->right;
             else {
-                // Equal key: replace data, splay existing node
+                // Equal key: replace data, then it counts as a lookup
                 cur->data = value;
-                splay(cur);
+                refreshUp(cur);
+                accessed(cur, depth);
                 return;
             }
+            ++depth;
         }
 
-        Node* newNode = new Node(value);
+        Node* newNode = createNode(value);
         newNode->parent = parent;
+        ++nodeCount;
 
-        if (value < parent->data)
+        if (less(value, parent->data))
             parent->left = newNode;
         else
             parent->right = newNode;
 
+        refresh(newNode); // splaying refreshes every ancestor
         splay(newNode);
     }
 
-    // Find node with given value; splay last accessed
+    // Like insert, but an existing node is left untouched. A new node is
+    // splayed to the root, an existing one handled as a lookup; inserted
+    // reports which case.
+    Node* findOrInsert(T value, bool& inserted) {
+        Node* cur = root;
+        Node* parent = nullptr;
+        std::size_t depth = 0;
+
+        while (cur) {
+            parent = cur;
+            if (less(value, cur->data))
+                cur = cur->left;
+            else if (less(cur->data, value))
+                cur = cur->right;
+            else {
+                inserted = false;
+                accessed(cur, depth);
+                return cur;
+            }
+            ++depth;
+        }
+
+        bool goLeft = parent && less(value, parent->data);
+        Node* newNode = createNode(std::move(value));
+        newNode->parent = parent;
+        ++nodeCount;
+
+        if (!parent)
+            root = newNode;
+        else if (goLeft)
+            parent->left = newNode;
+        else
+            parent->right = newNode;
+
+        inserted = true;
+        refresh(newNode); // splaying refreshes every ancestor
+        splay(newNode);
+        return newNode;
+    }
+
+    // Find node with given value; the last node visited counts as accessed
     Node* findNode(const T& value) {
         Node* cur = root;
         Node* last = nullptr;
+        std::size_t depth = 0;
 
         while (cur) {
             last = cur;
-            if (value < cur->data)
+            if (less(value, cur->data))
                 cur = cur->left;
-            else if (value > cur->data)
+            else if (less(cur->data, value))
                 cur = cur->right;
             else {
                 // Found
-                splay(cur);
+                accessed(cur, depth);
                 return cur;
             }
+            ++depth;
         }
 
-        if (last)
-            splay(last);
+        accessed(last, depth ? depth - 1 : 0);
         return nullptr;
     }
 
+    // First node not less than value (nullptr if none). The result, or the
+    // last node visited when there is none, counts as accessed.
+    Node* lowerBound(const T& value) {
+        Node* cur = root;
+        Node* best = nullptr;
+        Node* last = nullptr;
+        std::size_t depth = 0;
+
+        while (cur) {
+            last = cur;
+            if (less(cur->data, value)) {
+                cur = cur->right;
+            } else {
+                best = cur;
+                if (!less(value, cur->data))
+                    break;
+                cur = cur->left;
+            }
+            ++depth;
+        }
+
+        accessed(best ? best : last, depth);
+        return best;
+    }
+
+    // In-order neighbours; plain pointer walks that do not splay
+    Node* successor(Node* x) const {
+        if (x->right)
+            return subtreeMin(x->right);
+        while (x->parent && x == x->parent->right)
+            x = x->parent;
+        return x->parent;
+    }
+
+    Node* first() const {
+        return subtreeMin(root);
+    }
+
     bool contains(const T& value) {
         return findNode(value) != nullptr;
     }
 
-    // Remove value if present
-    void erase(const T& value) {
+    // Remove value if present; returns whether anything was removed
+    bool erase(const T& value) {
         Node* node = findNode(value);
-        if (!node) return;
+        if (!node) return false;
+        eraseNode(node);
+        return true;
+    }
 
-        splay(node); // should already be root
+    // ---- priority-queue operations ----
 
-        if (!node->left) {
-            replaceNode(node, node->right);
-        } else if (!node->right) {
-            replaceNode(node, node->left);
-        } else {
-            Node* minRight = subtreeMin(node->right);
-            if (minRight->parent != node) {
-                replaceNode(minRight, minRight->right);
-                minRight->right = node->right;
-                minRight->right->parent = minRight;
+    // Smallest/largest element (nullptr if empty), splayed to the root so
+    // a following pop or a repeated peek is O(1)
+    const T* min() {
+        Node* x = subtreeMin(root);
+        splay(x);
+        return x ? &x->data : nullptr;
+    }
+
+    const T* max() {
+        Node* x = subtreeMax(root);
+        splay(x);
+        return x ? &x->data : nullptr;
+    }
+
+    std::optional<T> popMin() {
+        return popRoot(min());
+    }
+
+    std::optional<T> popMax() {
+        return popRoot(max());
+    }
+
+    // Meld: move every element of other into this tree, leaving other
+    // empty. When one tree's elements all precede the other's and both
+    // share an allocator (heap, or the same arena), the trees are linked
+    // under the splayed extremum in O(log n) amortized; otherwise the
+    // elements are moved over one by one, other's winning on equal keys.
+    void join(SplayTree& other) {
+        if (&other == this || !other.root) return;
+
+        if (arena == other.arena) {
+            Node* linked = nullptr;
+            if (!root) {
+                linked = root = other.root;
+            } else if (less(*max(), *other.min())) {
+                root->right = other.root;
+                linked = root;
+            } else if (less(*other.max(), *min())) {
+                root->left = other.root;
+                linked = root;
+            }
+            if (linked) {
+                if (linked != other.root) {
+                    other.root->parent = linked;
+                    refresh(linked);
+                }
+                nodeCount += other.nodeCount;
+                other.root = nullptr;
+                other.clear();
+                return;
             }
-            replaceNode(node, minRight);
-            minRight->left = node->left;
-            minRight->left->parent = minRight;
         }
 
-        delete node;
+        // Look each key up before moving its data, so the data goes
+        // straight into its final node. A miss leaves the neighbour near
+        // the root, which keeps the following insert short.
+        for (Node* n = other.first(); n; n = other.successor(n)) {
+            if (Node* mine = findNode(n->data)) {
+                mine->data = std::move(n->data);
+                refreshUp(mine);
+            } else {
+                bool inserted = false;
+                findOrInsert(std::move(n->data), inserted);
+            }
+        }
+        other.clear();
+    }
+
+
+    std::size_t size() const {
+        return nodeCount;
+    }
+
+    bool empty() const {
+        return nodeCount == 0;
+    }
+
+    static constexpr std::size_t nodeBytes() {
+        return sizeof(Node);
+    }
+
+    // Relocate up to maxNodes nodes so that the top of the tree and each
+    // subtree below it are packed in allocation order. Call repeatedly;
+    // a pass restarts if nodes were erased since it began. Returns the
+    // number of nodes moved by this slice.
+    std::size_t defragment(std::size_t maxNodes, std::size_t hotLevels = 8) {
+        if (defragPos >= defragOrder.size() || defragEpoch != eraseEpoch)
+            buildDefragOrder(hotLevels);
+
+        std::size_t moved = 0;
+        while (moved < maxNodes && defragPos < defragOrder.size()) {
+            placeNext();
+            ++moved;
+        }
+
+        if (defragPos >= defragOrder.size()) {
+            defragOrder.clear();
+            slotOrder.clear();
+            defragPos = 0;
+            if (arena)
+                arena->releaseEmptyChunks();
+        }
+        return moved;
+    }
+
+    bool defragmentInProgress() const {
+        return defragPos < defragOrder.size();
+    }
+
+    // ---- splay policy ----
+
+    // Adaptive starts out splaying and re-decides every kWindow sampled
+    // lookups; a change needs two windows in a row agreeing on it
+    void setSplayPolicy(SplayPolicy p) {
+        policy = p;
+        mode = p == SplayPolicy::Adaptive ? SplayPolicy::Full : p;
+        samples = reuseHits = depthSum = pendingVotes = 0;
+        pendingMode = mode;
+    }
+
+    SplayPolicy splayPolicy() const {
+        return policy;
+    }
+
+    // What lookups currently do (Full, Semi or None)
+    SplayPolicy activeSplayPolicy() const {
+        return mode;
+    }
+
+    // Rebuild into a perfectly balanced tree in O(n), without moving any
+    // node. Worth it when lookups stop splaying, since nothing else would
+    // repair a shape left behind by skewed traffic.
+    void rebalance() {
+        std::vector<Node*> nodes;
+        nodes.reserve(nodeCount);
+        for (Node* n = first(); n; n = successor(n))
+            nodes.push_back(n);
+        root = build(nodes, 0, nodes.size(), nullptr);
     }
 
     const T* rootData() const {
         return root ? &root->data : nullptr;
     }
+
+    // Null unless the tree was built with a pooled/huge-page arena
+    const NodeArena* nodeArena() const {
+        return arena.get();
+    }
+};
+
+// =======================
+// MemoryUsage
+// =======================
+
+// Bytes attributed to one TreeMap, by component
+struct MemoryUsage {
+    std::size_t nodes = 0;     // node objects, including inline (SSO) key/value bytes
+    std::size_t extras = 0;    // out-of-line EntryExtras blocks (always heap allocated)
+    std::size_t keys = 0;      // key heap buffers beyond SSO
+    std::size_t values = 0;    // value heap buffers beyond SSO
+    std::size_t slack = 0;     // unused arena space / estimated malloc rounding
+    std::size_t metadata = 0;  // the map object and arena bookkeeping
+
+    std::size_t total() const {
+        return nodes + extras + keys + values + slack + metadata;
+    }
+};
+
+// Heap bytes owned by a string beyond its inline buffer
+inline std::size_t stringHeapBytes(const std::string& s) {
+    static const std::size_t inlineCapacity = std::string().capacity();
+    return s.capacity() > inlineCapacity ? s.capacity() + 1 : 0;
+}
+
+// Estimated allocator overhead for one malloc of n bytes: an 8-byte header
+// and rounding to 16, as glibc does
+inline std::size_t mallocSlack(std::size_t n) {
+    if (n == 0) return 0;
+    return (n + 8 + 15) / 16 * 16 - n;
+}
+
+// =======================
+// Range hashing
+// =======================
+
+// 64-bit hash of one entry: FNV-1a over key and value, then a splitmix
+// finalizer. Stable across processes, so replicas can compare digests.
+inline std::uint64_t entryHash(std::string_view key, std::string_view value) {
+    std::uint64_t h = 0xcbf29ce484222325ull;
+    auto mixIn = [&](std::string_view bytes) {
+        for (char c : bytes) {
+            h ^= static_cast<unsigned char>(c);
+            h *= 0x100000001b3ull;
+        }
+        h ^= bytes.size();
+        h *= 0x100000001b3ull;
+    };
+    mixIn(key);
+    mixIn(value);
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return h;
+}
+
+// Subtree sums of entry hashes. A sum does not depend on tree shape, so
+// equal key ranges of two maps have equal digests however each was
+// splayed. Inactive (a single branch per rotation) until turned on; once
+// active, every entry in the tree carries EntryExtras to hold its sums.
+struct RangeHashAugment {
+    static constexpr bool enabled = true;
+    bool active = false;
+
+    void operator()(KeyValuePair& kv, const KeyValuePair* left, const KeyValuePair* right) const {
+        if (!active) return;
+        EntryExtras& x = kv.ensureExtras();
+        x.subtreeHash = x.entryHash;
+        x.subtreeCount = 1;
+        for (const KeyValuePair* child : {left, right}) {
+            if (!child) continue;
+            x.subtreeHash += child->extras->subtreeHash;
+            x.subtreeCount += child->extras->subtreeCount;
+        }
+    }
+};
+
+// Hash and size of a key range
+struct RangeDigest {
+    std::uint64_t hash = 0;
+    std::size_t count = 0;
+
+    bool operator==(const RangeDigest&) const = default;
+};
+
+// One key on which two maps disagree; nullopt = absent on that side
+struct KeyDifference {
+    std::string key;
+    std::optional<std::string> mine;
+    std::optional<std::string> theirs;
+};
+
+// One page of TreeMap::scanPage
+struct ScanPage {
+    std::vector<std::pair<std::string, std::string>> entries;
+    std::string token;   // pass to the next scanPage call
+    bool done = false;   // no entries after this page
 };
 
 // =======================
 // TreeMap
 // =======================
 
+class Transaction;
+
 class TreeMap {
 private:
-    SplayTree<KeyValuePair> tree;
+    using Tree = SplayTree<KeyValuePair, std::less<KeyValuePair>, RangeHashAugment>;
+    using Node = Tree::Node;
+
+    Tree tree;
+
+    // Maintained on every mutation so memoryUsage() never walks the tree
+    std::size_t keyHeapBytes = 0;
+    std::size_t valueHeapBytes = 0;
+    std::size_t stringSlack = 0;
+
+    // Optional value compression; values of at least codecThreshold bytes
+    // are stored encoded when that actually saves space
+    std::shared_ptr<const ValueCodec> codec;
+    std::size_t codecThreshold = 0;
+
+    // Optional cold tier: values of nodes sitting at least coldDepth levels
+    // below the root are spilled to disk and faulted back in on access
+    std::unique_ptr<ColdStore> coldStore;
+    std::size_t coldDepth = 0;
+    std::size_t coldCount = 0;
+
+    // Ordered insert/delete events for subscribers (change data capture)
+    ChangeStream changes;
+
+    static constexpr char kScanTokenVersion = '1';
+
+    // Optional heavy-hitter tracking of get/find/insert keys
+    std::unique_ptr<HotKeySketch> hotKeySketch;
+
+    // Sort key computed once per stored key; identity means bytewise
+    KeyNormalizer normalizer;
+
+    // Search/insert probe carrying the precomputed sort key
+    KeyValuePair probe(std::string_view key) const {
+        KeyValuePair kv(key);
+        if (!normalizer.identity())
+            kv.setSortKey(normalizer(key));
+        return kv;
+    }
+
+    // Stored entries carry an EntryExtras block exactly when this holds.
+    // The blocks are heap allocated even on a pooled/huge-page arena, so
+    // memoryUsage() counts them apart from the node slots.
+    bool entriesHaveExtras() const {
+        return !normalizer.identity() || tree.augment.active;
+    }
+
+    void addKey(const KeyValuePair& kv) {
+        for (const std::string* k : {&kv.key, kv.sortKey()}) {
+            if (!k) continue;
+            keyHeapBytes += stringHeapBytes(*k);
+            stringSlack += mallocSlack(stringHeapBytes(*k));
+        }
+    }
+
+    void removeKey(const KeyValuePair& kv) {
+        for (const std::string* k : {&kv.key, kv.sortKey()}) {
+            if (!k) continue;
+            keyHeapBytes -= stringHeapBytes(*k);
+            stringSlack -= mallocSlack(stringHeapBytes(*k));
+        }
+    }
+
+    void addValue(const std::string& v) {
+        valueHeapBytes += stringHeapBytes(v);
+        stringSlack += mallocSlack(stringHeapBytes(v));
+    }
+
+    void removeValue(const std::string& v) {
+        valueHeapBytes -= stringHeapBytes(v);
+        stringSlack -= mallocSlack(stringHeapBytes(v));
+    }
+
+    // Encode first, so a throwing codec leaves the entry untouched
+    void assignValue(KeyValuePair& kv, std::string_view value) {
+        std::string packed;
+        bool usePacked = false;
+        if (codec && value.size() >= codecThreshold) {
+            packed = codec->compress(value);
+            usePacked = packed.size() < value.size();
+        }
+
+        releaseCold(kv);
+        removeValue(kv.value);
+
+        kv.compressed = usePacked;
+        if (usePacked)
+            kv.value = std::move(packed);
+        else
+            kv.value.assign(value);
+
+        addValue(kv.value);
+        if (tree.augment.active)
+            kv.ensureExtras().entryHash = entryHash(kv.key, value);
+    }
+
+    // Decoding happens here, on read, never eagerly
+    std::string loadValue(const KeyValuePair& kv) const {
+        return kv.compressed ? codec->decompress(kv.value) : kv.value;
+    }
+
+    // Drop the on-disk copy of a spilled value (the caller replaces it)
+    void releaseCold(KeyValuePair& kv) {
+        if (!kv.cold) return;
+        coldStore->release(ColdLocator::decode(kv.value));
+        kv.cold = false;
+        --coldCount;
+    }
+
+    // Value as the caller stored it, without faulting cold values back in
+    std::string readValue(const KeyValuePair& kv) const {
+        if (!kv.cold)
+            return loadValue(kv);
+        std::string stored = coldStore->get(ColdLocator::decode(kv.value));
+        return kv.compressed ? codec->decompress(stored) : stored;
+    }
+
+    // Bring a spilled value back into memory, still in its stored encoding
+    void faultIn(KeyValuePair& kv) {
+        if (!kv.cold) return;
+        ColdLocator loc = ColdLocator::decode(kv.value);
+        std::string stored = coldStore->get(loc);
+
+        coldStore->release(loc);
+        kv.cold = false;
+        --coldCount;
+
+        removeValue(kv.value);
+        kv.value = std::move(stored);
+        addValue(kv.value);
+    }
+
+    // ---- transaction rollback ----
+
+    friend class Transaction;
+
+    // An entry exactly as stored: its own key spelling, the stored value
+    // bytes (never a cold locator) and their encoding, plus the caller's
+    // value for change events
+    struct SavedEntry {
+        KeyValuePair stored;
+        std::string value;
+    };
+
+    // Read-only capture: no hot-key sample, no fault-in, no restructuring
+    // beyond the lookup's splay. Decodes only if subscribers need the value.
+    std::optional<SavedEntry> saveEntry(std::string_view key) {
+        auto* node = tree.findNode(probe(key));
+        if (!node)
+            return std::nullopt;
+        SavedEntry saved{node->data, {}};
+        if (saved.stored.cold) {
+            saved.stored.value = coldStore->get(ColdLocator::decode(saved.stored.value));
+            saved.stored.cold = false;
+        }
+        if (changes.hasSubscribers())
+            saved.value = loadValue(saved.stored);
+        return saved;
+    }
+
+    // Put back what saveEntry captured (nullopt: the key was absent). The
+    // stored bytes go in as they are, without the codec, so this can only
+    // fail if allocating a node does.
+    void restoreEntry(std::string_view key, std::optional<SavedEntry>& saved) {
+        if (!saved) {
+            deleteKey(std::string(key));
+            return;
+        }
+
+        KeyValuePair& kv = saved->stored;
+        Node* node = tree.findNode(kv);
+        if (node) {
+            releaseCold(node->data);
+            removeValue(node->data.value);
+            node->data.value = std::move(kv.value);
+            node->data.compressed = kv.compressed;
+            addValue(node->data.value);
+            if (tree.augment.active)
+                node->data.ensureExtras().entryHash = kv.extras->entryHash;
+        } else {
+            bool inserted = false;
+            node = tree.findOrInsert(std::move(kv), inserted);
+            addKey(node->data);
+            addValue(node->data.value);
+        }
+        tree.refreshUp(node);
+        changes.publish(MutationType::Insert, node->data.key, saved->value);
+    }
+
+    // Digest of the entries ordered before `bound` (every entry if nullopt).
+    // One descent adding the left subtrees passed on the way; the last
+    // node visited counts as a lookup.
+    RangeDigest digestBefore(std::optional<std::string_view> bound) {
+        if (!bound)
+            return tree.root ? RangeDigest{tree.root->data.extras->subtreeHash, tree.root->data.extras->subtreeCount}
+                             : RangeDigest{};
+
+        KeyValuePair limit = probe(*bound);
+        RangeDigest d;
+        Node* last = nullptr;
+        std::size_t depth = 0;
+        for (Node* n = tree.root; n; ++depth) {
+            last = n;
+            if (tree.less(n->data, limit)) {
+                d.hash += n->data.extras->entryHash;
+                ++d.count;
+                if (n->left) {
+                    d.hash += n->left->data.extras->subtreeHash;
+                    d.count += n->left->data.extras->subtreeCount;
+                }
+                n = n->right;
+            } else {
+                n = n->left;
+            }
+        }
+        tree.accessed(last, depth ? depth - 1 : 0);
+        return d;
+    }
+
+    struct RangeEntry {
+        std::string orderKey;
+        std::string key;
+        std::string value;
+    };
+
+    std::vector<RangeEntry> collectRange(std::optional<std::string_view> from, std::optional<std::string_view> to) {
+        std::vector<RangeEntry> out;
+        Node* node = from ? tree.lowerBound(probe(*from)) : tree.first();
+        std::optional<KeyValuePair> limit;
+        if (to)
+            limit = probe(*to);
+        for (; node && (!limit || tree.less(node->data, *limit)); node = tree.successor(node))
+            out.push_back(RangeEntry{node->data.orderKey(), node->data.key, readValue(node->data)});
+        return out;
+    }
+
+    // Split [from, to) at the median of whichever side holds more of it
+    // until the digests match or the range is small enough to compare
+    void diffRange(TreeMap& other, std::optional<std::string> from, std::optional<std::string> to,
+                   std::size_t leafSize, std::vector<KeyDifference>& out) {
+        RangeDigest mine = rangeDigest(from, to);
+        RangeDigest theirs = other.rangeDigest(from, to);
+        if (mine == theirs)
+            return;
+
+        if (std::max(mine.count, theirs.count) <= leafSize) {
+            std::vector<RangeEntry> a = collectRange(from, to);
+            std::vector<RangeEntry> b = other.collectRange(from, to);
+            std::size_t i = 0, j = 0;
+            while (i < a.size() || j < b.size()) {
+                if (j == b.size() || (i < a.size() && a[i].orderKey < b[j].orderKey)) {
+                    out.push_back(KeyDifference{std::move(a[i].key), std::move(a[i].value), std::nullopt});
+                    ++i;
+                } else if (i == a.size() || b[j].orderKey < a[i].orderKey) {
+                    out.push_back(KeyDifference{std::move(b[j].key), std::nullopt, std::move(b[j].value)});
+                    ++j;
+                } else {
+                    if (a[i].value != b[j].value)
+                        out.push_back(KeyDifference{std::move(a[i].key), std::move(a[i].value), std::move(b[j].value)});
+                    ++i;
+                    ++j;
+                }
+            }
+            return;
+        }
+
+        TreeMap& larger = mine.count >= theirs.count ? *this : other;
+        std::size_t firstRank = from ? larger.digestBefore(*from).count : 0;
+        std::optional<std::string> mid = larger.keyAtRank(firstRank + std::max(mine.count, theirs.count) / 2);
+        diffRange(other, from, mid, leafSize, out);
+        diffRange(other, mid, to, leafSize, out);
+    }
+
+    // Copy every cold value into `target` and make it the cold store.
+    // Locators are rewritten only after all copies succeeded, so a failure
+    // leaves the current store in charge.
+    void migrateCold(std::unique_ptr<ColdStore> target) {
+        std::vector<std::pair<KeyValuePair*, ColdLocator>> moved;
+        moved.reserve(coldCount);
+        if (coldCount) {
+            for (auto* node = tree.first(); node; node = tree.successor(node)) {
+                KeyValuePair& kv = node->data;
+                if (kv.cold)
+                    moved.emplace_back(&kv, target->put(coldStore->get(ColdLocator::decode(kv.value))));
+            }
+        }
+        for (auto& [kv, loc] : moved)
+            kv->value = loc.encode();   // same length, so accounting is unchanged
+        coldStore = std::move(target);
+    }
+
+    void spill(KeyValuePair& kv) {
+        ColdLocator loc = coldStore->put(kv.value);
+        removeValue(kv.value);
+        kv.value = loc.encode();
+        kv.value.shrink_to_fit();
+        addValue(kv.value);
+        kv.cold = true;
+        ++coldCount;
+    }
 
 public:
     TreeMap() = default;
 
-    // Insert or update
-    void insert(const std::string& key, const std::string& value) {
-        KeyValuePair kv(key, value);
-        tree.insert(kv);
+    // Nodes (and any keys/values short enough for SSO) live in the arena
+    explicit TreeMap(ArenaMode mode) : tree(mode) {}
+
+    // Keys ordered (and matched) by `order`; e.g. with CaseInsensitive,
+    // "Apple" and "APPLE" are one entry that keeps the first spelling
+    explicit TreeMap(KeyOrder order, const std::locale& loc = std::locale())
+        : normalizer(KeyNormalizer::forOrder(order, loc)) {}
+
+    // Custom order: keys compare by the bytes keyNormalizer returns
+    explicit TreeMap(KeyNormalizer keyNormalizer, ArenaMode mode = ArenaMode::Heap)
+        : tree(mode), normalizer(std::move(keyNormalizer)) {}
+
+    // Sort key `key` is stored under (the key itself for bytewise maps)
+    std::string sortKeyFor(std::string_view key) const {
+        return normalizer(key);
+    }
+
+    // Insert or update. Bytes are copied straight from the views into the
+    // node, so callers holding a network buffer need no temporaries.
+    void insert(std::string_view key, std::string_view value) {
+        if (hotKeySketch)
+            hotKeySketch->record(key);
+        bool inserted = false;
+        auto* node = tree.findOrInsert(probe(key), inserted);
+        try {
+            assignValue(node->data, value);
+        } catch (...) {
+            if (inserted)
+                tree.erase(node->data); // don't leave a half-built entry behind
+            throw;
+        }
+        if (inserted)
+            addKey(node->data);
+        tree.refreshUp(node); // picks up the new hash
+        changes.publish(MutationType::Insert, key, value);
     }
 
     // Get value for key, or "" if not found
     std::string get(const std::string& key) {
-        KeyValuePair searchKey(key);
-        auto* node = tree.findNode(searchKey);
+        return find(key).value_or(""); // default if not found
+    }
 
-        if (node && node->data.key == key) {
-            return node->data.value;
+    // Like get, but tells a missing key apart from an empty value
+    std::optional<std::string> find(const std::string& key) {
+        if (hotKeySketch)
+            hotKeySketch->record(key);
+        auto* node = tree.findNode(probe(key));
+        if (node) {
+            faultIn(node->data);
+            return loadValue(node->data);
         }
-        return ""; // default if not found
+        return std::nullopt;
     }
 
-    // Delete key if present
-    void deleteKey(const std::string& key) {
-        KeyValuePair searchKey(key);
-        tree.erase(searchKey);
+    // Delete key if present; returns whether it was
+    bool deleteKey(const std::string& key) {
+        auto* node = tree.findNode(probe(key));
+        if (!node) return false;
+
+        releaseCold(node->data);
+        removeKey(node->data);
+        removeValue(node->data.value);
+        tree.eraseNode(node);
+        changes.publish(MutationType::Delete, key, {});
+        return true;
     }
+
+    std::size_t size() const {
+        return tree.size();
+    }
+
+    // Remove every entry. Subscribers get one Clear event, not per-key deletes.
+    void clear() {
+        if (coldCount) {
+            for (auto* node = tree.first(); node; node = tree.successor(node))
+                releaseCold(node->data);
+        }
+        tree.clear();
+        keyHeapBytes = 0;
+        valueHeapBytes = 0;
+        stringSlack = 0;
+        changes.publish(MutationType::Clear, {}, {});
+    }
+
+    // Receive every later insert/deleteKey/clear, in order and with sequence
+    // numbers, through a lock-free ring of `capacity` events. Subscribe
+    // from the thread that mutates the map; read from any one thread.
+    // Cancel it, or drop the last handle, to stop receiving.
+    std::shared_ptr<ChangeSubscription> subscribe(std::size_t capacity = 4096) {
+        return changes.subscribe(capacity);
+    }
+
+    // Sequence number of the most recent mutation (0 before any)
+    std::uint64_t lastSequence() const {
+        return changes.lastSequence();
+    }
+
+    // Visit entries with key >= from in the map's key order until fn(key, value)
+    // returns false. One splay positions the scan; the walk itself does
+    // not restructure the tree. fn must not modify the map.
+    template <typename Fn>
+    void scan(const std::string& from, Fn fn) {
+        auto* node = tree.lowerBound(probe(from));
+        for (; node; node = tree.successor(node)) {
+            if (!fn(node->data.key, readValue(node->data)))
+                return;
+        }
+    }
+
+    // Up to `limit` entries following the position `token` encodes ("" for
+    // the start). The token names the last key returned, not a node, so
+    // resuming is one O(log n) seek and stays correct if keys are
+    // inserted or deleted between pages: the next page starts at the
+    // first key still after it. Throws std::invalid_argument for a token
+    // this map did not produce.
+    ScanPage scanPage(std::string_view token, std::size_t limit) {
+        ScanPage page;
+        Node* node = nullptr;
+        if (token.empty()) {
+            node = tree.lowerBound(KeyValuePair());
+        } else {
+            if (token[0] != kScanTokenVersion)
+                throw std::invalid_argument("scanPage: bad continuation token");
+            KeyValuePair after;
+            after.setSortKey(std::string(token.substr(1)));
+            node = tree.lowerBound(after);
+            if (node && node->data.orderKey() == after.orderKey())
+                node = tree.successor(node);
+        }
+
+        const KeyValuePair* last = nullptr;
+        for (; node && page.entries.size() < limit; node = tree.successor(node)) {
+            page.entries.emplace_back(node->data.key, readValue(node->data));
+            last = &node->data;
+        }
+
+        page.done = !node;
+        if (!last) {
+            page.token = token;
+        } else if (!page.done) {
+            page.token.push_back(kScanTokenVersion);
+            page.token += last->orderKey();
+        }
+        return page;
+    }
+
+    // Entries whose key starts with `prefix`, in key order, until fn
+    // returns false. Ranges are contiguous in bytewise maps, which is
+    // where composite keys (key_encoding.hpp) belong: a prefix of leading
+    // encoded fields selects every tuple that begins with them.
+    template <typename Fn>
+    void scanPrefix(std::string_view prefix, Fn fn) {
+        auto* node = tree.lowerBound(probe(prefix));
+        for (; node && node->data.key.starts_with(prefix); node = tree.successor(node)) {
+            if (!fn(node->data.key, readValue(node->data)))
+                return;
+        }
+    }
+
+    // Like scan, but values are never read (nor faulted in or decoded)
+    template <typename Fn>
+    void scanKeys(const std::string& from, Fn fn) {
+        auto* node = tree.lowerBound(probe(from));
+        for (; node; node = tree.successor(node)) {
+            if (!fn(node->data.key))
+                return;
+        }
+    }
+
+    // Spill values of nodes at depth >= depthThreshold to a file at `path`.
+    // Splaying keeps recently used keys near the root, so depth is a free
+    // recency signal. Throws std::runtime_error if the file can't be opened.
+    // Calling it again with another path moves already spilled values to
+    // the new file; with the same path it only changes the threshold.
+    void enableColdTier(const std::string& path, std::size_t depthThreshold = 24) {
+        if (!coldStore)
+            coldStore = std::make_unique<ColdStore>(path);
+        else if (coldStore->filePath() != path)
+            migrateCold(std::make_unique<ColdStore>(path));
+        coldDepth = depthThreshold;
+    }
+
+    // Rewrite the cold file with only its live values. spillCold() does
+    // this on its own once more than half the file is dead.
+    void compactColdTier() {
+        if (!coldStore) return;
+        std::string path = coldStore->filePath();
+        migrateCold(std::make_unique<ColdStore>(path + ".compact"));
+        coldStore->renameTo(path);   // the old store already unlinked it
+    }
+
+    // Walk the tree and spill up to maxValues deep, still-resident values.
+    // Values no larger than a locator stay in memory. Returns how many
+    // values were moved out.
+    std::size_t spillCold(std::size_t maxValues) {
+        if (!coldStore || !tree.root) return 0;
+        if (coldStore->wantsCompaction())
+            compactColdTier();
+
+        std::size_t spilled = 0;
+        std::vector<std::pair<Node*, std::size_t>> stack;
+        stack.emplace_back(tree.root, 0);
+
+        while (!stack.empty() && spilled < maxValues) {
+            auto [node, depth] = stack.back();
+            stack.pop_back();
+
+            KeyValuePair& kv = node->data;
+            if (depth >= coldDepth && !kv.cold && kv.value.size() > ColdLocator::kEncodedSize) {
+                spill(kv);
+                ++spilled;
+            }
+
+            if (node->left) stack.emplace_back(node->left, depth + 1);
+            if (node->right) stack.emplace_back(node->right, depth + 1);
+        }
+        return spilled;
+    }
+
+    // Number of values currently living in the cold tier
+    std::size_t coldValues() const {
+        return coldCount;
+    }
+
+    // Size of the cold file, dead space included
+    std::uint64_t coldFileBytes() const {
+        return coldStore ? coldStore->fileBytes() : 0;
+    }
+
+    // Compress values of at least `threshold` bytes with `valueCodec`.
+    // Only allowed on an empty map, since stored values must stay decodable;
+    // returns false otherwise. Pass nullptr to turn compression off.
+    bool setValueCodec(std::shared_ptr<const ValueCodec> valueCodec,
+                       std::size_t threshold = 256) {
+        if (tree.size() != 0) return false;
+        codec = std::move(valueCodec);
+        codecThreshold = threshold;
+        return true;
+    }
+
+    // Current footprint by component, from counters kept up to date on
+    // insert/delete (no traversal)
+    MemoryUsage memoryUsage() const {
+        MemoryUsage usage;
+        std::size_t nodeBytes = Tree::nodeBytes();
+
+        usage.nodes = tree.size() * nodeBytes;
+        if (entriesHaveExtras())
+            usage.extras = tree.size() * sizeof(EntryExtras);
+        usage.keys = keyHeapBytes;
+        usage.values = valueHeapBytes;
+        usage.metadata = sizeof(TreeMap);
+
+        if (const NodeArena* arena = tree.nodeArena()) {
+            usage.slack = arena->bytesReserved() - usage.nodes;
+            usage.metadata += arena->bookkeepingBytes();
+        } else {
+            usage.slack = tree.size() * mallocSlack(nodeBytes);
+        }
+        if (entriesHaveExtras())
+            usage.slack += tree.size() * mallocSlack(sizeof(EntryExtras));
+        usage.slack += stringSlack;
+        return usage;
+    }
+
+    const NodeArena* nodeArena() const {
+        return tree.nodeArena();
+    }
+
+    // Incremental, bounded-slice node relocation; see SplayTree::defragment
+    std::size_t defragment(std::size_t maxNodes, std::size_t hotLevels = 8) {
+        return tree.defragment(maxNodes, hotLevels);
+    }
+
+    bool defragmentInProgress() const {
+        return tree.defragmentInProgress();
+    }
+
+    // Lookup restructuring; see SplayPolicy. Adaptive suits traffic that
+    // alternates between skewed and uniform phases.
+    void setSplayPolicy(SplayPolicy policy) {
+        tree.setSplayPolicy(policy);
+    }
+
+    SplayPolicy splayPolicy() const {
+        return tree.splayPolicy();
+    }
+
+    SplayPolicy activeSplayPolicy() const {
+        return tree.activeSplayPolicy();
+    }
+
+    // O(n) rebuild into a balanced tree
+    void rebalance() {
+        tree.rebalance();
+    }
+
+    // ---- hot keys ----
+
+    // Track the hottest keys read or written with a space-saving sketch
+    // of `capacity` counters (memory stays bounded by it), recording about
+    // one access in sampleEvery. Replaces any previous tracking.
+    void enableHotKeyTracking(std::size_t capacity = 128, std::uint32_t sampleEvery = 1) {
+        hotKeySketch = std::make_unique<HotKeySketch>(capacity, sampleEvery);
+    }
+
+    void disableHotKeyTracking() {
+        hotKeySketch.reset();
+    }
+
+    // Up to k hottest keys since tracking began (or the last reset), with
+    // estimated counts, error bounds and rates; empty if not tracking
+    std::vector<HotKey> hotKeys(std::size_t k = 10) const {
+        return hotKeySketch ? hotKeySketch->top(k) : std::vector<HotKey>{};
+    }
+
+    void resetHotKeys() {
+        if (hotKeySketch)
+            hotKeySketch->reset();
+    }
+
+    // ---- range hashing ----
+
+    // Maintain per-subtree hash sums from now on (an O(n) pass over the
+    // current entries). Needed by rangeDigest, keyAtRank and diff, which
+    // turn it on by themselves.
+    void enableRangeHashing() {
+        if (tree.augment.active) return;
+        tree.augment.active = true;
+
+        std::vector<Node*> order;
+        if (tree.root)
+            order.push_back(tree.root);
+        for (std::size_t i = 0; i < order.size(); ++i) {
+            if (order[i]->left) order.push_back(order[i]->left);
+            if (order[i]->right) order.push_back(order[i]->right);
+        }
+        for (auto it = order.rbegin(); it != order.rend(); ++it) {
+            KeyValuePair& kv = (*it)->data;
+            kv.ensureExtras().entryHash = entryHash(kv.key, readValue(kv));
+            tree.refresh(*it);
+        }
+    }
+
+    bool rangeHashingEnabled() const {
+        return tree.augment.active;
+    }
+
+    // Hash and count of the entries in [from, to); nullopt bounds are open.
+    // O(log n) amortized. Equal digests mean equal contents (up to 64-bit
+    // hash collisions), whatever the shape of either tree.
+    RangeDigest rangeDigest(std::optional<std::string_view> from = std::nullopt,
+                            std::optional<std::string_view> to = std::nullopt) {
+        enableRangeHashing();
+        RangeDigest end = digestBefore(to);
+        if (!from)
+            return end;
+        RangeDigest start = digestBefore(from);
+        if (start.count >= end.count)
+            return {};
+        return RangeDigest{end.hash - start.hash, end.count - start.count};
+    }
+
+    // Key of the rank-th entry in key order (0-based)
+    std::optional<std::string> keyAtRank(std::size_t rank) {
+        enableRangeHashing();
+        Node* n = tree.root;
+        for (std::size_t depth = 0; n; ++depth) {
+            std::size_t leftCount = n->left ? n->left->data.extras->subtreeCount : 0;
+            if (rank < leftCount) {
+                n = n->left;
+            } else if (rank == leftCount) {
+                tree.accessed(n, depth);
+                return n->data.key;
+            } else {
+                rank -= leftCount + 1;
+                n = n->right;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Keys whose presence or value differs between this map and other
+    // (which must use the same key order), in key order. Compares range
+    // digests top-down, splitting only ranges that differ, so the cost is
+    // O(d log n) digests for d differences; ranges of at most leafSize
+    // entries are compared entry by entry.
+    std::vector<KeyDifference> diff(TreeMap& other, std::size_t leafSize = 16) {
+        std::vector<KeyDifference> out;
+        if (&other != this)
+            diffRange(other, std::nullopt, std::nullopt, std::max<std::size_t>(leafSize, 1), out);
+        return out;
+    }
+
+    // Start buffering an atomic multi-key batch; see Transaction
+    Transaction transaction();
+};
+
+// =======================
+// Transaction
+// =======================
+
+// Buffers inserts/deletes (and optional expectations on current values)
+// and applies them all-or-nothing in one sorted pass over the tree, which
+// splays cheaply because consecutive keys are neighbours. If a
+// precondition fails nothing is applied; if applying throws midway, the
+// already applied keys are restored, with their original spelling and
+// stored bytes, before the exception propagates. Subscribers see a
+// rollback as ordinary compensating mutations.
+class Transaction {
+public:
+    explicit Transaction(TreeMap& m)
+        : map(m) {}
+
+    Transaction& insert(std::string_view key, std::string_view value) {
+        ops.push_back(Op{std::string(key), map.sortKeyFor(key), std::string(value), false, ops.size()});
+        return *this;
+    }
+
+    Transaction& deleteKey(std::string_view key) {
+        ops.push_back(Op{std::string(key), map.sortKeyFor(key), {}, true, ops.size()});
+        return *this;
+    }
+
+    // Commit only if `key` currently maps to `value` (nullopt = absent)
+    Transaction& expect(std::string_view key, std::optional<std::string> value) {
+        expectations.push_back(Expectation{std::string(key), map.sortKeyFor(key), std::move(value)});
+        return *this;
+    }
+
+    // Returns false, changing nothing, if an expectation did not hold.
+    // The transaction is empty again afterwards.
+    bool commit() {
+        std::sort(expectations.begin(), expectations.end(),
+                  [](const Expectation& a, const Expectation& b) { return a.sortKey < b.sortKey; });
+        for (const Expectation& e : expectations) {
+            if (map.find(e.key) != e.value) {
+                reset();
+                return false;
+            }
+        }
+
+        // Sort in map order, keeping only the last op issued for each key
+        std::sort(ops.begin(), ops.end(), [](const Op& a, const Op& b) {
+            return a.sortKey != b.sortKey ? a.sortKey < b.sortKey : a.order < b.order;
+        });
+        std::vector<Op> finalOps;
+        for (std::size_t i = 0; i < ops.size(); ++i)
+            if (i + 1 == ops.size() || ops[i + 1].sortKey != ops[i].sortKey)
+                finalOps.push_back(std::move(ops[i]));
+
+        // Capture every touched entry before changing any, so a failure
+        // here leaves the map as it was
+        std::vector<std::optional<TreeMap::SavedEntry>> undo;
+        undo.reserve(finalOps.size());
+        try {
+            for (const Op& op : finalOps)
+                undo.push_back(map.saveEntry(op.key));
+        } catch (...) {
+            reset();
+            throw;
+        }
+
+        std::size_t applied = 0;
+        try {
+            for (const Op& op : finalOps) {
+                ++applied; // a throwing op may have been partly applied
+                if (op.erase)
+                    map.deleteKey(op.key);
+                else
+                    map.insert(op.key, op.value);
+            }
+        } catch (...) {
+            while (applied-- > 0)
+                map.restoreEntry(finalOps[applied].key, undo[applied]);
+            reset();
+            throw;
+        }
+
+        reset();
+        return true;
+    }
+
+    // Drop everything buffered so far
+    void reset() {
+        ops.clear();
+        expectations.clear();
+    }
+
+    std::size_t pending() const {
+        return ops.size();
+    }
+
+private:
+    struct Op {
+        std::string key;
+        std::string sortKey;
+        std::string value;
+        bool erase;
+        std::size_t order;   // issue order, so the last op on a key wins
+    };
+
+    struct Expectation {
+        std::string key;
+        std::string sortKey;
+        std::optional<std::string> value;
+    };
+
+    TreeMap& map;
+    std::vector<Op> ops;
+    std::vector<Expectation> expectations;
 };
 
+inline Transaction TreeMap::transaction() {
+    return Transaction(*this);
+}
+
 #endif // TREEMAP_HPP
@@ -3,8 +3,20 @@
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/benchmark/catch_benchmark.hpp>
 #include <catch2/benchmark/catch_constructor.hpp>
+#include <catch2/generators/catch_generators.hpp>
 #include <catch2/generators/catch_generators_range.hpp>
 
+#include <thread>
+
+#include "../src/checkpoint.hpp"
+#include "../src/flat_combining.hpp"
+#include "../src/interval_map.hpp"
+#include "../src/key_encoding.hpp"
+#include "../src/mvcc.hpp"
+#include "../src/replication.hpp"
+#include "../src/sequence.hpp"
+#include "../src/sharded_map.hpp"
+#include "../src/server.hpp"
 #include "../src/tree.hpp"
 
 // ------------------------------------------------------
@@ -92,6 +104,1601 @@ TEST_CASE("TreeMap handles multiple keys") {
     }
 }
 
+TEST_CASE("TreeMap with arena-backed nodes") {
+    auto mode = GENERATE(ArenaMode::Pooled, ArenaMode::HugePages);
+    TreeMap map(mode);
+
+    for (int i = 0; i < 20000; ++i) {
+        map.insert("key_" + std::to_string(i), "value_" + std::to_string(i));
+    }
+
+    REQUIRE(map.get("key_0")     == "value_0");
+    REQUIRE(map.get("key_19999") == "value_19999");
+
+    for (int i = 0; i < 20000; i += 2) {
+        map.deleteKey("key_" + std::to_string(i));
+    }
+
+    REQUIRE(map.get("key_2") == "");
+    REQUIRE(map.get("key_3") == "value_3");
+
+    const NodeArena* arena = map.nodeArena();
+    REQUIRE(arena != nullptr);
+    REQUIRE(arena->slotsInUse() == 10000);
+    REQUIRE(arena->chunkCount() >= 1);
+
+    // freed slots are reused before new chunks are carved
+    std::size_t chunks = arena->chunkCount();
+    for (int i = 0; i < 20000; i += 2) {
+        map.insert("key_" + std::to_string(i), "again");
+    }
+    REQUIRE(arena->chunkCount() == chunks);
+    REQUIRE(map.get("key_4") == "again");
+}
+
+TEST_CASE("TreeMap defragments in bounded slices") {
+    auto mode = GENERATE(ArenaMode::Heap, ArenaMode::Pooled);
+    TreeMap map(mode);
+
+    // churn: interleave inserts and deletes so nodes scatter
+    for (int i = 0; i < 5000; ++i) {
+        map.insert("key_" + std::to_string(i), "value_" + std::to_string(i));
+        if (i % 3 == 0) {
+            map.deleteKey("key_" + std::to_string(i / 2));
+        }
+    }
+
+    SECTION("a full pass keeps every entry reachable") {
+        std::size_t slices = 0;
+        do {
+            map.defragment(256);
+            ++slices;
+        } while (map.defragmentInProgress());
+
+        REQUIRE(slices > 1);
+        REQUIRE(map.get("key_4999") == "value_4999");
+        REQUIRE(map.get("key_4000") == "value_4000");
+        REQUIRE(map.get("key_0")    == "");
+    }
+
+    SECTION("an erase between slices restarts the pass safely") {
+        map.defragment(100);
+        REQUIRE(map.defragmentInProgress());
+
+        map.deleteKey("key_4998");
+        map.insert("fresh", "node");
+
+        while (map.defragment(1000) > 0 && map.defragmentInProgress()) {}
+
+        REQUIRE(map.get("key_4998") == "");
+        REQUIRE(map.get("fresh")    == "node");
+        REQUIRE(map.get("key_4997") == "value_4997");
+    }
+}
+
+TEST_CASE("TreeMap defragmentation compacts the arena") {
+    TreeMap map(ArenaMode::Pooled);
+    for (int i = 0; i < 60000; ++i)
+        map.insert("key_" + std::to_string(i), "value_" + std::to_string(i));
+    for (int i = 0; i < 60000; i += 3)
+        map.deleteKey("key_" + std::to_string(i));
+
+    auto fullPass = [&] {
+        while (map.defragment(1000) > 0 && map.defragmentInProgress()) {}
+    };
+
+    fullPass();
+    MemoryUsage settled = map.memoryUsage();
+    std::size_t chunks = map.nodeArena()->chunkCount();
+    REQUIRE(chunks > 1);
+    for (int pass = 0; pass < 5; ++pass) {
+        fullPass();
+        REQUIRE(map.memoryUsage().total() <= settled.total());
+        REQUIRE(map.nodeArena()->chunkCount() <= chunks);
+    }
+
+    // Dropping most entries and compacting hands chunks back
+    for (int i = 0; i < 60000; ++i)
+        if (i % 60 != 1)
+            map.deleteKey("key_" + std::to_string(i));
+    fullPass();
+    REQUIRE(map.nodeArena()->chunkCount() == 1);
+    REQUIRE(map.memoryUsage().total() < settled.total());
+    REQUIRE(map.size() == 1000);
+    REQUIRE(map.get("key_59941") == "value_59941");
+    REQUIRE(map.get("key_59942") == "");
+}
+
+TEST_CASE("TreeMap reports memory usage by component") {
+    TreeMap map;
+    MemoryUsage empty = map.memoryUsage();
+
+    REQUIRE(empty.nodes  == 0);
+    REQUIRE(empty.keys   == 0);
+    REQUIRE(empty.values == 0);
+
+    std::string longValue(200, 'v');
+    map.insert("short", "tiny");
+    map.insert("a_key_that_is_definitely_longer_than_sso", longValue);
+
+    MemoryUsage used = map.memoryUsage();
+    REQUIRE(map.size() == 2);
+    REQUIRE(used.nodes > 0);
+    REQUIRE(used.keys   >= 40);
+    REQUIRE(used.values >= 200);
+    REQUIRE(used.total() > empty.total());
+
+    SECTION("overwriting a value replaces its contribution") {
+        map.insert("a_key_that_is_definitely_longer_than_sso", std::string(1000, 'w'));
+        REQUIRE(map.memoryUsage().values >= 1000);
+        REQUIRE(map.memoryUsage().values < 1000 + used.values);
+    }
+
+    SECTION("deleting returns the map to its empty footprint") {
+        map.deleteKey("short");
+        map.deleteKey("a_key_that_is_definitely_longer_than_sso");
+        map.deleteKey("never_inserted");
+
+        MemoryUsage after = map.memoryUsage();
+        REQUIRE(map.size() == 0);
+        REQUIRE(after.nodes  == 0);
+        REQUIRE(after.keys   == 0);
+        REQUIRE(after.values == 0);
+        REQUIRE(after.slack  == empty.slack);
+    }
+
+    SECTION("per-entry extras cost memory only once a feature needs them") {
+        STATIC_REQUIRE(sizeof(KeyValuePair) <= 2 * sizeof(std::string) + 2 * sizeof(void*));
+
+        REQUIRE(used.extras == 0);
+        map.enableRangeHashing();
+        REQUIRE(map.memoryUsage().nodes == used.nodes);
+        REQUIRE(map.memoryUsage().extras == map.size() * sizeof(EntryExtras));
+        REQUIRE(map.rangeDigest().count == 2);
+    }
+}
+
+TEST_CASE("TreeMap memory usage on a pooled arena") {
+    auto fill = [](TreeMap& map) {
+        for (int i = 0; i < 20000; ++i)
+            map.insert("key_" + std::to_string(i), "v");
+    };
+
+    SECTION("a key order's extras are heap blocks, not arena slack") {
+        TreeMap map(KeyNormalizer::forOrder(KeyOrder::CaseInsensitive), ArenaMode::Pooled);
+        fill(map);
+
+        MemoryUsage usage = map.memoryUsage();
+        REQUIRE(usage.slack < map.nodeArena()->bytesReserved());
+        REQUIRE(usage.nodes <= map.nodeArena()->bytesReserved());
+        REQUIRE(usage.extras == map.size() * sizeof(EntryExtras));
+    }
+
+    SECTION("turning on range hashing adds heap extras, not arena slack") {
+        TreeMap map(ArenaMode::Pooled);
+        fill(map);
+        std::size_t slackBefore = map.memoryUsage().slack;
+
+        map.enableRangeHashing();
+        MemoryUsage usage = map.memoryUsage();
+        REQUIRE(usage.slack < map.nodeArena()->bytesReserved());
+        REQUIRE(usage.slack == slackBefore + map.size() * mallocSlack(sizeof(EntryExtras)));
+        REQUIRE(usage.extras == map.size() * sizeof(EntryExtras));
+    }
+}
+
+TEST_CASE("LzCodec round-trips values") {
+    std::string json = R"({"user":"brad","role":"admin","tags":["a","b"],"active":true})";
+    std::string repetitive;
+    for (int i = 0; i < 50; ++i) {
+        repetitive += json;
+    }
+
+    SECTION("without a dictionary") {
+        LzCodec codec;
+        for (const std::string& raw : {std::string(), std::string("x"), json, repetitive}) {
+            REQUIRE(codec.decompress(codec.compress(raw)) == raw);
+        }
+        REQUIRE(codec.compress(repetitive).size() < repetitive.size() / 10);
+    }
+
+    SECTION("with a trained dictionary") {
+        std::vector<std::string> samples;
+        for (int i = 0; i < 20; ++i) {
+            samples.push_back(R"({"user":"user)" + std::to_string(i) +
+                              R"(","role":"member","tags":["a","b"],"active":true})");
+        }
+        LzCodec plain;
+        LzCodec trained = LzCodec::train(samples, 1024);
+
+        REQUIRE_FALSE(trained.dictionaryBytes().empty());
+        REQUIRE(trained.decompress(trained.compress(json)) == json);
+        REQUIRE(trained.compress(json).size() < plain.compress(json).size());
+    }
+
+    SECTION("rejects corrupt input") {
+        LzCodec codec;
+        std::string packed = codec.compress(repetitive);
+        packed.resize(packed.size() / 2);
+        REQUIRE_THROWS(codec.decompress(packed));
+    }
+}
+
+TEST_CASE("TreeMap compresses large values transparently") {
+    TreeMap map;
+    REQUIRE(map.setValueCodec(std::make_shared<LzCodec>(), 64));
+
+    std::string big;
+    for (int i = 0; i < 100; ++i) {
+        big += R"({"id":1,"name":"same"})";
+    }
+
+    map.insert("big", big);
+    map.insert("small", "short value");
+
+    REQUIRE(map.get("big")   == big);
+    REQUIRE(map.get("small") == "short value");
+    REQUIRE(map.memoryUsage().values < big.size());
+
+    // codec can only change while the map is empty
+    REQUIRE_FALSE(map.setValueCodec(nullptr));
+}
+
+TEST_CASE("TreeMap spills deep values to a cold tier") {
+    TreeMap map;
+    map.enableColdTier("treemap_cold_test.bin", 4);
+
+    // sequential inserts leave a long left spine behind the root
+    for (int i = 0; i < 200; ++i) {
+        map.insert("key_" + std::to_string(1000 + i), std::string(64, 'a' + i % 26));
+    }
+
+    std::size_t spilled = map.spillCold(1000);
+    REQUIRE(spilled > 0);
+    REQUIRE(map.coldValues() == spilled);
+    REQUIRE(map.memoryUsage().values < 200 * 64);
+
+    SECTION("cold values are faulted back in on get") {
+        REQUIRE(map.get("key_1000") == std::string(64, 'a'));
+        REQUIRE(map.coldValues() == spilled - 1);
+    }
+
+    SECTION("overwriting or deleting a cold value releases it") {
+        map.insert("key_1001", "new");
+        map.deleteKey("key_1002");
+
+        REQUIRE(map.coldValues() == spilled - 2);
+        REQUIRE(map.get("key_1001") == "new");
+        REQUIRE(map.get("key_1002") == "");
+    }
+
+    SECTION("moving the cold tier keeps spilled values") {
+        map.enableColdTier("treemap_cold_test.bin", 4);
+        REQUIRE(map.coldValues() == spilled);
+        map.enableColdTier("treemap_cold_test_moved.bin", 4);
+        REQUIRE(map.coldValues() == spilled);
+        for (int i = 0; i < 200; ++i)
+            REQUIRE(map.get("key_" + std::to_string(1000 + i)) == std::string(64, 'a' + i % 26));
+    }
+
+    SECTION("dead space in the cold file is compacted away") {
+        std::uint64_t largest = 0;
+        for (int round = 0; round < 6; ++round) {
+            for (int i = 0; i < 200; ++i)
+                map.insert("key_" + std::to_string(1000 + i), std::string(1024, 'A' + round));
+            map.spillCold(1000);
+            largest = std::max(largest, map.coldFileBytes());
+        }
+        REQUIRE(largest < 3 * 200 * 1024);
+        REQUIRE(map.get("key_1150") == std::string(1024, 'F'));
+    }
+}
+
+TEST_CASE("TextProtocol parses pipelined commands") {
+    TextProtocol protocol;
+    std::string_view input = "SET user Brad Pitt\r\nGET user\nDEL us";
+    Command cmd;
+
+    std::size_t used = protocol.parse(input, cmd);
+    REQUIRE(cmd.type == CommandType::Set);
+    REQUIRE(cmd.args.size() == 2);
+    REQUIRE(cmd.args[0] == "user");
+    REQUIRE(cmd.args[1] == "Brad Pitt");
+
+    input.remove_prefix(used);
+    used = protocol.parse(input, cmd);
+    REQUIRE(cmd.type == CommandType::Get);
+    REQUIRE(cmd.args[0] == "user");
+
+    // incomplete line waits for more input
+    input.remove_prefix(used);
+    REQUIRE(protocol.parse(input, cmd) == 0);
+}
+
+// Send `request` to the server over a fresh Unix socket connection and
+// collect `expectedBytes` of response, driving the event loop in between
+static std::string serverRoundTrip(TreeMapServer& server, const std::string& path,
+                                   const std::string& request, std::size_t expectedBytes) {
+    int client = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    REQUIRE(::connect(client, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+    REQUIRE(::send(client, request.data(), request.size(), 0) == static_cast<ssize_t>(request.size()));
+
+    std::string response;
+    for (int i = 0; i < 50 && response.size() < expectedBytes; ++i) {
+        server.runOnce(50);
+        char buf[4096];
+        ssize_t n;
+        while ((n = ::recv(client, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+            response.append(buf, static_cast<std::size_t>(n));
+    }
+    ::close(client);
+    return response;
+}
+
+TEST_CASE("TreeMapServer serves pipelined requests over a Unix socket") {
+    TreeMap map;
+    TreeMapServer server(map);
+    std::string path = "treemap_server_test.sock";
+    server.listenUnix(path);
+
+    std::string request = "SET a 1\nSET b two words\nGET b\nGET missing\nDEL a\nGET a\nQUIT\n";
+    std::string expected = "OK\nOK\nVALUE 9\ntwo words\nNOT_FOUND\nINT 1\nNOT_FOUND\nBYE\n";
+
+    REQUIRE(serverRoundTrip(server, path, request, expected.size()) == expected);
+    REQUIRE(map.get("b") == "two words");
+    REQUIRE(server.stats().commands == 7);
+}
+
+TEST_CASE("TreeMapServer bounds connection buffers") {
+    TreeMap map;
+    TreeMapServer server(map);
+    std::string path = "treemap_limits_test.sock";
+    server.listenUnix(path);
+    server.setBufferLimits(1024, 16);
+
+    SECTION("replies past the output limit pause reading, not the client") {
+        std::string request, expected;
+        for (int i = 0; i < 50; ++i) {
+            request += "SET k" + std::to_string(i) + " v\nGET k" + std::to_string(i) + "\n";
+            expected += "OK\nVALUE 1\nv\n";
+        }
+        REQUIRE(serverRoundTrip(server, path, request, expected.size()) == expected);
+    }
+
+    SECTION("a request larger than the input limit is refused") {
+        std::string response = serverRoundTrip(server, path, "SET big " + std::string(4096, 'x'), 6);
+        REQUIRE(response.rfind("ERROR ", 0) == 0);
+        REQUIRE(map.size() == 0);
+    }
+
+    SECTION("a half-closed client gets its replies, then is dropped") {
+        int client = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        REQUIRE(::connect(client, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+        std::string request = "SET a 1\nGET a\n";
+        REQUIRE(::send(client, request.data(), request.size(), 0) == static_cast<ssize_t>(request.size()));
+        ::shutdown(client, SHUT_WR);
+
+        for (int i = 0; i < 20 && (server.connectionCount() > 0 || server.stats().connections == 0); ++i)
+            server.runOnce(50);
+        REQUIRE(server.connectionCount() == 0);
+
+        std::string response;
+        char buf[256];
+        ssize_t n;
+        while ((n = ::recv(client, buf, sizeof(buf), 0)) > 0)
+            response.append(buf, static_cast<std::size_t>(n));
+        ::close(client);
+        REQUIRE(response == "OK\nVALUE 1\n1\n");
+    }
+}
+
+TEST_CASE("RespProtocol parses bulk strings in place") {
+    RespProtocol protocol;
+    std::string input = "*3\r\n$3\r\nSET\r\n$4\r\nuser\r\n$6\r\nBr\r\nad\r\n*1\r\n$4\r\nPI";
+    Command cmd;
+
+    std::size_t used = protocol.parse(input, cmd);
+    REQUIRE(cmd.type == CommandType::Set);
+    REQUIRE(cmd.args.size() == 2);
+    REQUIRE(cmd.args[1] == "Br\r\nad");
+    REQUIRE(cmd.args[1].data() == input.data() + input.find("Br")); // no copy
+
+    REQUIRE(protocol.parse(std::string_view(input).substr(used), cmd) == 0);
+    REQUIRE_THROWS_AS(protocol.parse("*1\r\n$x\r\n", cmd), ProtocolError);
+
+    std::string out;
+    protocol.encode(Reply::nil(), out);
+    REQUIRE(out == "$-1\r\n");
+    REQUIRE(protocol.negotiate(3));
+    out.clear();
+    protocol.encode(Reply::nil(), out);
+    REQUIRE(out == "_\r\n");
+}
+
+TEST_CASE("TreeMap scans keys in order from a lower bound") {
+    TreeMap map;
+    for (const char* k : {"delta", "alpha", "echo", "charlie", "bravo"}) {
+        map.insert(k, std::string("v_") + k);
+    }
+
+    std::vector<std::string> seen;
+    map.scan("b", [&](const std::string& key, const std::string& value) {
+        seen.push_back(key + "=" + value);
+        return seen.size() < 3;
+    });
+    REQUIRE(seen == std::vector<std::string>{"bravo=v_bravo", "charlie=v_charlie", "delta=v_delta"});
+
+    std::vector<std::string> keys;
+    map.scanKeys("", [&](const std::string& key) {
+        keys.push_back(key);
+        return true;
+    });
+    REQUIRE(keys.size() == 5);
+    REQUIRE(keys.front() == "alpha");
+    REQUIRE(keys.back()  == "echo");
+}
+
+TEST_CASE("TreeMapServer speaks RESP") {
+    TreeMap map;
+    TreeMapServer server(map);
+    std::string path = "treemap_resp_test.sock";
+    server.listenUnix(path);
+
+    auto cmd = [](std::initializer_list<std::string> parts) {
+        std::string out = "*" + std::to_string(parts.size()) + "\r\n";
+        for (const std::string& p : parts) {
+            out += "$" + std::to_string(p.size()) + "\r\n" + p + "\r\n";
+        }
+        return out;
+    };
+
+    std::string request = cmd({"MSET", "a", "1", "b", "2", "c", "3"}) +
+                          cmd({"MGET", "a", "zz", "c"}) +
+                          cmd({"ZRANGEBYLEX", "ignored", "(a", "+"}) +
+                          cmd({"SCAN", "0", "COUNT", "2"}) +
+                          cmd({"SCAN", "1", "COUNT", "2"}) +
+                          cmd({"SCAN", "12345678901234567890"}) +
+                          cmd({"DEL", "a", "b", "zz"}) +
+                          cmd({"DBSIZE"}) +
+                          cmd({"HELLO", "2"}) +
+                          cmd({"HELLO", "3"});
+    std::string expected = "+OK\r\n"
+                           "*3\r\n$1\r\n1\r\n$-1\r\n$1\r\n3\r\n"
+                           "*2\r\n$1\r\nb\r\n$1\r\nc\r\n"
+                           "*2\r\n$1\r\n1\r\n*2\r\n$1\r\na\r\n$1\r\nb\r\n"
+                           "*2\r\n$1\r\n0\r\n*1\r\n$1\r\nc\r\n"
+                           "-ERR invalid cursor\r\n"
+                           ":2\r\n"
+                           ":1\r\n"
+                           "*6\r\n$6\r\nserver\r\n$7\r\ntreemap\r\n$5\r\nproto\r\n:2\r\n$4\r\nkeys\r\n:1\r\n"
+                           "%3\r\n$6\r\nserver\r\n$7\r\ntreemap\r\n$5\r\nproto\r\n:3\r\n$4\r\nkeys\r\n:1\r\n";
+
+    REQUIRE(serverRoundTrip(server, path, request, expected.size()) == expected);
+}
+
+TEST_CASE("TreeMapServer keeps SCAN cursors per connection") {
+    TreeMap map;
+    for (const char* k : {"a", "b", "c"})
+        map.insert(k, "v");
+    TreeMapServer server(map);
+    std::string path = "treemap_cursor_test.sock";
+    server.listenUnix(path);
+
+    auto open = [&] {
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        REQUIRE(::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+        return fd;
+    };
+    auto exchange = [&](int fd, const std::string& request, std::size_t expectedBytes) {
+        REQUIRE(::send(fd, request.data(), request.size(), 0) == static_cast<ssize_t>(request.size()));
+        std::string response;
+        for (int i = 0; i < 200 && response.size() < expectedBytes; ++i) {
+            server.runOnce(10);
+            char buf[4096];
+            ssize_t n;
+            while ((n = ::recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+                response.append(buf, static_cast<std::size_t>(n));
+        }
+        return response;
+    };
+    const std::string scanStart = "*4\r\n$4\r\nSCAN\r\n$1\r\n0\r\n$5\r\nCOUNT\r\n$1\r\n1\r\n";
+    const std::string firstPage = "*2\r\n$1\r\n1\r\n*1\r\n$1\r\na\r\n";
+
+    int first = open();
+    int second = open();
+    REQUIRE(exchange(first, scanStart, firstPage.size()) == firstPage);
+
+    // the other client opens more cursors than one connection may keep
+    std::string flood;
+    for (int i = 0; i < 5000; ++i)
+        flood += scanStart;
+    std::string flooded = exchange(second, flood, 5000 * firstPage.size());
+    REQUIRE(flooded.size() >= 5000 * firstPage.size());
+
+    const std::string resume = "*4\r\n$4\r\nSCAN\r\n$1\r\n1\r\n$5\r\nCOUNT\r\n$1\r\n1\r\n";
+    const std::string secondPage = "*2\r\n$1\r\n2\r\n*1\r\n$1\r\nb\r\n";
+    REQUIRE(exchange(first, resume, secondPage.size()) == secondPage);
+    REQUIRE(exchange(second, resume, 21) == "-ERR invalid cursor\r\n");
+
+    ::close(first);
+    ::close(second);
+}
+
+TEST_CASE("TreeMapServer executes binary batches") {
+    TreeMap map;
+    TreeMapServer server(map);
+    std::string path = "treemap_binary_test.sock";
+    server.listenUnix(path);
+
+    using Op = BinaryProtocol::Op;
+    std::string request;
+    BinaryProtocol::appendBatch(request, {
+        Op{BinaryProtocol::OpSet, "k1", std::string_view("bin\0ary", 7)},
+        Op{BinaryProtocol::OpSet, "k2", "v2"},
+        Op{BinaryProtocol::OpGet, "k1", {}},
+        Op{BinaryProtocol::OpDel, "k2", {}},
+        Op{BinaryProtocol::OpGet, "k2", {}},
+    });
+    BinaryProtocol::appendBatch(request, {Op{BinaryProtocol::OpPing, {}, {}}});
+
+    // 2 headers + OK, OK, 7-byte value, 8-byte integer, nil, PONG
+    std::size_t expectedBytes = 2 * BinaryProtocol::kReplyHeader + 6 * BinaryProtocol::kReplyRecordHeader +
+                                2 + 2 + 7 + 8 + 0 + 4;
+    std::string response = serverRoundTrip(server, path, request, expectedBytes);
+
+    std::vector<BinaryProtocol::DecodedReply> replies;
+    std::size_t used = BinaryProtocol::parseReplyBatch(response, replies);
+    REQUIRE(used > 0);
+    REQUIRE(BinaryProtocol::parseReplyBatch(std::string_view(response).substr(used), replies) > 0);
+
+    REQUIRE(replies.size() == 6);
+    REQUIRE(replies[0].status == BinaryProtocol::StatusOk);
+    REQUIRE(replies[2].status == BinaryProtocol::StatusValue);
+    REQUIRE(replies[2].bytes  == std::string("bin\0ary", 7));
+    REQUIRE(replies[3].status == BinaryProtocol::StatusInteger);
+    REQUIRE(replies[3].integer == 1);
+    REQUIRE(replies[4].status == BinaryProtocol::StatusNil);
+    REQUIRE(replies[5].bytes  == "PONG");
+
+    // one event-loop batch covered the whole pipelined request
+    REQUIRE(server.stats().largestBatch == 6);
+
+    SECTION("large values are written from their own buffers") {
+        std::string big(100000, 'z');
+        big[500] = '!';
+        map.insert("big", big);
+
+        std::string get;
+        BinaryProtocol::appendBatch(get, {Op{BinaryProtocol::OpGet, "big", {}}});
+        std::string reply = serverRoundTrip(server, path, get,
+                                            BinaryProtocol::kReplyHeader + BinaryProtocol::kReplyRecordHeader + big.size());
+        replies.clear();
+        REQUIRE(BinaryProtocol::parseReplyBatch(reply, replies) > 0);
+        REQUIRE(replies.size() == 1);
+        REQUIRE(replies[0].bytes == big);
+    }
+}
+
+TEST_CASE("ReplyBuffer gathers large payloads without copying") {
+    ReplyBuffer out;
+    out += "$4096\r\n";
+    std::string payload(4096, 'p');
+    const char* bytes = payload.data();
+    out.appendPayload(std::move(payload));
+    out += "\r\n";
+    out.appendPayload(std::string("tiny"));
+
+    REQUIRE(out.segmentCount() == 3);
+    REQUIRE(out.size() == 7 + 4096 + 2 + 4);
+
+    iovec parts[8];
+    REQUIRE(out.gather(parts, 8) == 3);
+    REQUIRE(parts[1].iov_base == bytes);
+
+    out.consume(10);
+    REQUIRE(out.gather(parts, 8) == 2);
+    REQUIRE(static_cast<const char*>(parts[0].iov_base) == bytes + 3);
+    out.consume(4093 + 2);
+    REQUIRE(out.str() == "tiny");
+    out.consume(4);
+    REQUIRE(out.empty());
+    REQUIRE(out.segmentCount() == 0);
+}
+
+TEST_CASE("TreeMap streams mutations to subscribers") {
+    TreeMap map;
+    map.insert("before", "not seen");
+
+    auto sub = map.subscribe(4);
+    map.insert("a", "1");
+    map.insert("a", "2");
+    map.deleteKey("a");
+    map.deleteKey("missing"); // no event: nothing was removed
+
+    std::vector<MutationEvent> events;
+    REQUIRE(sub->readBatch(events, 10) == 3);
+    REQUIRE(events[0].type  == MutationType::Insert);
+    REQUIRE(events[1].value == "2");
+    REQUIRE(events[2].type  == MutationType::Delete);
+    REQUIRE(events[2].key   == "a");
+    REQUIRE(events[0].sequence + 2 == events[2].sequence);
+    REQUIRE(map.lastSequence() == events[2].sequence);
+
+    SECTION("a full ring drops events and reports overflow") {
+        for (int i = 0; i < 6; ++i) {
+            map.insert("k" + std::to_string(i), "v");
+        }
+        REQUIRE(sub->overflowed());
+        REQUIRE(sub->dropped() == 2);
+        REQUIRE(sub->pending() == 4);
+    }
+
+    SECTION("dropping the handle unsubscribes") {
+        std::weak_ptr<ChangeSubscription> abandoned = map.subscribe(4);
+        REQUIRE_FALSE(abandoned.expired());   // only the map holds it now
+
+        map.insert("after", "1");
+        REQUIRE(abandoned.expired());
+        REQUIRE(sub->pending() == 1);
+    }
+
+    SECTION("a consumer thread drains concurrently") {
+        auto big = map.subscribe(1024);
+        std::vector<MutationEvent> received;
+        std::thread consumer([&] {
+            while (received.size() < 500) {
+                big->readBatch(received, 64);
+            }
+        });
+        for (int i = 0; i < 500; ++i) {
+            map.insert("t" + std::to_string(i), std::to_string(i));
+        }
+        consumer.join();
+
+        REQUIRE_FALSE(big->overflowed());
+        for (std::size_t i = 1; i < received.size(); ++i) {
+            REQUIRE(received[i].sequence == received[i - 1].sequence + 1);
+        }
+    }
+}
+
+TEST_CASE("Replica follows a primary over a Unix socket") {
+    TreeMap primaryMap;
+    primaryMap.insert("existing", "snapshot");
+
+    std::string path = "treemap_replication_test.sock";
+    ReplicationPrimary primary(primaryMap, path, 8);
+
+    TreeMap replicaMap;
+    ReplicaClient replica(replicaMap, path);
+
+    auto sync = [&] {
+        for (int i = 0; i < 20; ++i) {
+            primary.pump();
+            replica.poll();
+            if (replica.synced() && replica.appliedSequence() == primaryMap.lastSequence()) return;
+            ::usleep(1000);
+        }
+    };
+
+    sync();
+    REQUIRE(replica.synced());
+    REQUIRE(replicaMap.get("existing") == "snapshot");
+
+    primaryMap.insert("a", "1");
+    primaryMap.insert("b", "2");
+    primaryMap.deleteKey("existing");
+    sync();
+
+    REQUIRE(replicaMap.get("a") == "1");
+    REQUIRE(replicaMap.get("b") == "2");
+    REQUIRE(replicaMap.get("existing") == "");
+
+    SECTION("an overflowed change ring triggers a fresh snapshot") {
+        for (int i = 0; i < 50; ++i) {
+            primaryMap.insert("bulk_" + std::to_string(i), "x");
+        }
+        sync();
+
+        REQUIRE(replicaMap.size() == primaryMap.size());
+        REQUIRE(replicaMap.get("bulk_49") == "x");
+        REQUIRE(replica.appliedSequence() == primaryMap.lastSequence());
+    }
+
+    SECTION("clear is replicated") {
+        primaryMap.clear();
+        primaryMap.insert("fresh", "1");
+        sync();
+
+        REQUIRE(replicaMap.size() == 1);
+        REQUIRE(replicaMap.get("fresh") == "1");
+        REQUIRE(replicaMap.get("a") == "");
+    }
+}
+
+TEST_CASE("Replication streams snapshots larger than the backlog limit") {
+    TreeMap primaryMap;
+    std::string value(1000, 'v');
+    for (int i = 0; i < 2000; ++i) {
+        primaryMap.insert("key_" + std::to_string(i), value);
+    }
+
+    // ~2 MB of snapshot against a 64 KB limit on live mutations
+    std::string path = "treemap_replication_large.sock";
+    ReplicationPrimary primary(primaryMap, path, 1 << 12, 64 * 1024);
+    TreeMap replicaMap;
+    ReplicaClient replica(replicaMap, path);
+
+    for (int i = 0; i < 2000 && !replica.synced(); ++i) {
+        primary.pump();
+        if (i == 1) {
+            primaryMap.insert("key_0", "changed");   // lands mid-snapshot
+            primaryMap.deleteKey("key_1999");
+        }
+        replica.poll();
+    }
+    for (int i = 0; i < 20 && replica.appliedSequence() != primaryMap.lastSequence(); ++i) {
+        primary.pump();
+        replica.poll();
+        ::usleep(1000);
+    }
+
+    REQUIRE(primary.replicaCount() == 1);
+    REQUIRE(replica.synced());
+    REQUIRE(replicaMap.size() == primaryMap.size());
+    REQUIRE(replicaMap.get("key_0") == "changed");
+    REQUIRE(replicaMap.get("key_1999") == "");
+    REQUIRE(replicaMap.get("key_1000") == value);
+}
+
+TEST_CASE("Replica keeps its data when a resync is cut short") {
+    using replication::RecordKind;
+    std::string path = "treemap_replication_fake.sock";
+    ::unlink(path.c_str());
+    int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    REQUIRE(::bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+    REQUIRE(::listen(listener, 1) == 0);
+
+    TreeMap replicaMap;
+    ReplicaClient replica(replicaMap, path);
+    int conn = ::accept(listener, nullptr, nullptr);
+    REQUIRE(conn >= 0);
+
+    std::string stream;
+    replication::appendRecord(stream, RecordKind::SnapshotBegin, 1, {}, {});
+    replication::appendRecord(stream, RecordKind::Put, 1, "kept", "old");
+    replication::appendRecord(stream, RecordKind::SnapshotEnd, 1, {}, {});
+    replication::appendRecord(stream, RecordKind::SnapshotBegin, 5, {}, {});
+    replication::appendRecord(stream, RecordKind::Put, 5, "partial", "new");
+    REQUIRE(::send(conn, stream.data(), stream.size(), 0) == static_cast<ssize_t>(stream.size()));
+    ::close(conn);
+    ::close(listener);
+    ::unlink(path.c_str());
+
+    replica.poll();
+    REQUIRE_THROWS_AS(replica.poll(), std::runtime_error);
+    REQUIRE_FALSE(replica.synced());
+    REQUIRE(replicaMap.size() == 1);
+    REQUIRE(replicaMap.get("kept") == "old");
+    REQUIRE(replicaMap.get("partial") == "");
+}
+
+TEST_CASE("Background checkpoint captures a consistent snapshot") {
+    TreeMap map;
+    for (int i = 0; i < 2000; ++i) {
+        map.insert("key_" + std::to_string(i), "value_" + std::to_string(i));
+    }
+
+    std::string path = "treemap_checkpoint_test.bin";
+    BackgroundCheckpoint checkpoint(map, path);
+
+    // writes keep going while the child walks its copy-on-write image
+    map.insert("after", "not in checkpoint");
+    map.deleteKey("key_0");
+
+    CheckpointStats stats = checkpoint.wait();
+    REQUIRE(stats.entries == 2000);
+    REQUIRE(stats.bytes > 2000 * 8);
+    REQUIRE(checkpoint.done());
+
+    TreeMap restored;
+    REQUIRE(loadCheckpoint(restored, path) == 2000);
+    REQUIRE(restored.get("key_0")    == "value_0");
+    REQUIRE(restored.get("key_1999") == "value_1999");
+    REQUIRE(restored.get("after")    == "");
+
+    SECTION("a truncated file is rejected") {
+        REQUIRE(::truncate(path.c_str(), 100) == 0);
+        REQUIRE_THROWS(loadCheckpoint(restored, path));
+
+        // the map it was loading into is left as it was
+        REQUIRE(restored.size() == 2000);
+        REQUIRE(restored.get("key_1999") == "value_1999");
+    }
+
+    SECTION("a length running past the end of the file is rejected") {
+        std::FILE* f = std::fopen(path.c_str(), "wb");
+        const unsigned char header[] = {0xfe, 0xff, 0xff, 0xff, 0xfe, 0xff, 0xff, 0xff};
+        std::fwrite("TMCKPT1\n", 1, 8, f);
+        std::fwrite(header, 1, sizeof(header), f);
+        std::fwrite("short", 1, 5, f);
+        std::fclose(f);
+
+        REQUIRE_THROWS_AS(loadCheckpoint(restored, path), std::runtime_error);
+        REQUIRE(restored.size() == 2000);
+    }
+    std::remove(path.c_str());
+}
+
+TEST_CASE("VersionedTreeMap serves point-in-time reads") {
+    VersionedTreeMap map;
+
+    std::uint64_t t1 = map.insert("a", "1");
+    map.insert("b", "1");
+    std::uint64_t snap = map.openSnapshot();
+
+    map.insert("a", "2");
+    map.deleteKey("b");
+    map.insert("c", "new");
+
+    REQUIRE(map.get("a")       == "2");
+    REQUIRE(map.get("a", t1)   == "1");
+    REQUIRE(map.get("a", snap) == "1");
+    REQUIRE(map.get("b", snap) == "1");
+    REQUIRE_FALSE(map.get("b").has_value());
+    REQUIRE_FALSE(map.get("c", snap).has_value());
+    REQUIRE(map.deleteKey("missing") == 0);
+
+    std::vector<std::string> seen;
+    map.scan("", snap, [&](const std::string& key, const std::string& value) {
+        seen.push_back(key + "=" + value);
+        return true;
+    });
+    REQUIRE(seen == std::vector<std::string>{"a=1", "b=1"});
+
+    SECTION("garbage collection keeps what pinned snapshots can see") {
+        map.collectGarbage();
+        REQUIRE(map.get("a", snap) == "1");
+        REQUIRE(map.keyCount() == 3);
+
+        map.releaseSnapshot(snap);
+        std::size_t removed = map.collectGarbage();
+        REQUIRE(removed >= 2);            // old "a" and "b" versions, and "b" itself
+        REQUIRE(map.keyCount() == 2);
+        REQUIRE(map.versionCount() == 2);
+        REQUIRE(map.get("a") == "2");
+        REQUIRE_THROWS_AS(map.get("a", t1), SnapshotTooOld);
+    }
+
+    SECTION("unpinned history is trimmed and then refused") {
+        map.releaseSnapshot(snap);
+        for (int i = 0; i < 100; ++i) {
+            map.insert("a", std::to_string(i));
+        }
+
+        REQUIRE(map.versionCount() <= 3 * (VersionedTreeMap::kChainSlack + 1));
+        REQUIRE(map.get("a") == "99");
+        REQUIRE(map.get("a", map.now()) == "99");
+        REQUIRE_THROWS_AS(map.get("a", t1), SnapshotTooOld);
+        REQUIRE_THROWS_AS(map.scan("", snap, [](const std::string&, const std::string&) { return true; }),
+                          SnapshotTooOld);
+    }
+}
+
+TEST_CASE("TreeMap transactions apply all-or-nothing") {
+    TreeMap map;
+    map.insert("balance_a", "100");
+    map.insert("balance_b", "50");
+
+    SECTION("a successful commit applies every op, last write per key wins") {
+        auto tx = map.transaction();
+        tx.insert("balance_b", "60")
+          .insert("balance_a", "90")
+          .insert("balance_a", "80")
+          .deleteKey("missing")
+          .expect("balance_a", "100");
+
+        REQUIRE(tx.commit());
+        REQUIRE(map.get("balance_a") == "80");
+        REQUIRE(map.get("balance_b") == "60");
+        REQUIRE(tx.pending() == 0);
+    }
+
+    SECTION("a failed expectation changes nothing") {
+        auto tx = map.transaction();
+        tx.insert("balance_a", "0").deleteKey("balance_b").expect("balance_b", "999");
+
+        REQUIRE_FALSE(tx.commit());
+        REQUIRE(map.get("balance_a") == "100");
+        REQUIRE(map.get("balance_b") == "50");
+    }
+
+    SECTION("expecting absence") {
+        auto tx = map.transaction();
+        tx.insert("fresh", "1").expect("fresh", std::nullopt);
+        REQUIRE(tx.commit());
+
+        tx.insert("fresh", "2").expect("fresh", std::nullopt);
+        REQUIRE_FALSE(tx.commit());
+        REQUIRE(map.get("fresh") == "1");
+    }
+
+    SECTION("an exception midway rolls back what was applied") {
+        struct FailingCodec : ValueCodec {
+            std::string compress(std::string_view raw) const override {
+                if (raw == "boom") throw std::runtime_error("codec failure");
+                return std::string(raw);
+            }
+            std::string decompress(const std::string& packed) const override {
+                return packed;
+            }
+        };
+        TreeMap guarded;
+        guarded.setValueCodec(std::make_shared<FailingCodec>(), 0);
+        guarded.insert("a", "old");
+
+        auto tx = guarded.transaction();
+        tx.insert("a", "new").insert("b", "new").insert("c", "boom");
+
+        REQUIRE_THROWS(tx.commit());
+        REQUIRE(guarded.get("a") == "old");
+        REQUIRE_FALSE(guarded.find("b").has_value());
+        REQUIRE_FALSE(guarded.find("c").has_value());
+    }
+
+    SECTION("rollback bypasses a failing codec and keeps the stored spelling") {
+        struct ArmedCodec : ValueCodec {
+            bool armed = false;
+            std::string compress(std::string_view raw) const override {
+                if (armed) throw std::runtime_error("codec failure");
+                return std::string(raw) + "~";   // never smaller: stored raw
+            }
+            std::string decompress(const std::string& packed) const override {
+                return packed;
+            }
+        };
+        auto codec = std::make_shared<ArmedCodec>();
+        TreeMap guarded(KeyOrder::CaseInsensitive);
+        guarded.setValueCodec(codec, 0);
+        guarded.insert("Foo", "1");
+        auto sub = guarded.subscribe(16);
+        codec->armed = true;
+
+        auto tx = guarded.transaction();
+        tx.deleteKey("FOO").insert("zzz", "x");
+        REQUIRE_THROWS_AS(tx.commit(), std::runtime_error);
+
+        REQUIRE(guarded.size() == 1);
+        REQUIRE(guarded.get("foo") == "1");
+        std::vector<std::string> keys;
+        guarded.scanKeys("", [&](const std::string& k) {
+            keys.push_back(k);
+            return true;
+        });
+        REQUIRE(keys == std::vector<std::string>{"Foo"});
+
+        std::vector<MutationEvent> events;
+        sub->readBatch(events, 16);
+        REQUIRE(events.size() == 2);   // the delete, then its compensation
+        REQUIRE(events[1].type == MutationType::Insert);
+        REQUIRE(events[1].key == "Foo");
+        REQUIRE(events[1].value == "1");
+    }
+}
+
+TEST_CASE("TreeMap orders keys by a precomputed sort key") {
+    SECTION("case-insensitive keys are one entry") {
+        TreeMap map(KeyOrder::CaseInsensitive);
+        map.insert("Apple", "1");
+        map.insert("banana", "2");
+        map.insert("APPLE", "3");
+
+        REQUIRE(map.size() == 2);
+        REQUIRE(map.get("apple") == "3");
+
+        std::vector<std::string> keys;
+        map.scanKeys("B", [&](const std::string& k) {
+            keys.push_back(k);
+            return true;
+        });
+        REQUIRE(keys == std::vector<std::string>{"banana"});
+
+        REQUIRE(map.deleteKey("BANANA"));
+        REQUIRE(map.size() == 1);
+    }
+
+    SECTION("custom normalizer") {
+        // Order by reversed bytes, i.e. by suffix
+        TreeMap map(KeyNormalizer([](std::string_view k) { return std::string(k.rbegin(), k.rend()); }));
+        for (const char* k : {"xa", "yc", "zb"})
+            map.insert(k, k);
+
+        std::vector<std::string> keys;
+        map.scanKeys("", [&](const std::string& k) {
+            keys.push_back(k);
+            return true;
+        });
+        REQUIRE(keys == std::vector<std::string>{"xa", "zb", "yc"});
+    }
+
+    SECTION("a normalizer may map keys to an empty sort key") {
+        // Digits only: "abc" and "xyz" both normalize to ""
+        TreeMap map(KeyNormalizer([](std::string_view k) {
+            std::string digits;
+            for (char c : k)
+                if (c >= '0' && c <= '9') digits += c;
+            return digits;
+        }));
+        map.insert("a5", "five");
+        map.insert("abc", "1");
+        map.insert("xyz", "2");
+
+        REQUIRE(map.size() == 2);
+        REQUIRE(map.get("abc") == "2");
+        REQUIRE(map.get("q") == "2");
+
+        std::vector<std::string> keys;
+        map.scanKeys("", [&](const std::string& k) {
+            keys.push_back(k);
+            return true;
+        });
+        REQUIRE(keys == std::vector<std::string>{"abc", "a5"});
+    }
+
+    SECTION("transactions coalesce keys that normalize alike") {
+        TreeMap map(KeyOrder::CaseInsensitive);
+        auto tx = map.transaction();
+        tx.insert("Key", "1").insert("KEY", "2");
+        REQUIRE(tx.commit());
+        REQUIRE(map.size() == 1);
+        REQUIRE(map.get("key") == "2");
+    }
+
+    SECTION("SplayTree takes a comparator") {
+        SplayTree<int, std::greater<int>> tree;
+        for (int i : {3, 1, 2})
+            tree.insert(i);
+        REQUIRE(tree.first()->data == 3);
+    }
+}
+
+TEST_CASE("Natural key order sorts embedded numbers by value") {
+    REQUIRE(naturalSortKey("key_2") < naturalSortKey("key_10"));
+    REQUIRE(naturalSortKey("key_10") < naturalSortKey("key_10a"));
+    REQUIRE(naturalSortKey("key_9z") < naturalSortKey("key_10"));
+    REQUIRE(naturalSortKey("key_7") != naturalSortKey("key_007"));
+    REQUIRE(naturalSortKey(std::string(300, '9')) < naturalSortKey("1" + std::string(300, '0')));
+
+    TreeMap map(KeyOrder::Natural);
+    for (int i : {10, 2, 33, 1, 100, 7})
+        map.insert("key_" + std::to_string(i), std::to_string(i));
+    map.insert("key_007", "leading zeros");
+    map.insert("item", "text");
+
+    std::vector<std::string> keys;
+    map.scanKeys("key_5", [&](const std::string& k) {
+        keys.push_back(k);
+        return true;
+    });
+    REQUIRE(keys == std::vector<std::string>{"key_7", "key_007", "key_10", "key_33", "key_100"});
+    REQUIRE(map.get("key_007") == "leading zeros");
+    REQUIRE(map.get("key_7") == "7");
+}
+
+TEST_CASE("Composite keys sort in tuple order") {
+    using namespace std::chrono;
+    KeyEncoder::TimePoint t0 = system_clock::time_point(seconds(1700000000));
+
+    REQUIRE(encodeKey("a", 5) < encodeKey("a", 10));
+    REQUIRE(encodeKey("a", -1) < encodeKey("a", 0));
+    REQUIRE(encodeKey("a", 99) < encodeKey("ab", 0));
+    REQUIRE(encodeKey(std::string("a\0", 2)) > encodeKey("a"));
+    REQUIRE(encodeKey(-2.5) < encodeKey(-1.0));
+    REQUIRE(encodeKey(-1.0) < encodeKey(0.5));
+
+    // every integer width picks its signedness's encoding
+    REQUIRE(encodeKey(-3LL) == encodeKey(std::int64_t{-3}));
+    REQUIRE(encodeKey(short{-3}) == encodeKey(std::int64_t{-3}));
+    REQUIRE(encodeKey(7u) == encodeKey(std::uint64_t{7}));
+    REQUIRE(encodeKey(0.5f) == encodeKey(0.5));
+
+    // NaNs of either sign are one value, after +inf
+    double inf = std::numeric_limits<double>::infinity();
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    REQUIRE(encodeKey(-nan) == encodeKey(nan));
+    REQUIRE(encodeKey(inf) < encodeKey(-nan));
+
+    std::string key = encodeKey(std::string("us\0er", 5), std::int64_t{-42}, t0, 3.25);
+    KeyDecoder d(key);
+    REQUIRE(d.readString() == std::string("us\0er", 5));
+    REQUIRE(d.readInt64() == -42);
+    REQUIRE(d.readTimestamp() == t0);
+    REQUIRE(d.readDouble() == 3.25);
+    REQUIRE(d.atEnd());
+    REQUIRE_THROWS(KeyDecoder(key.substr(0, 4)).readString());
+
+    TreeMap map;
+    for (const char* user : {"alice", "bob", "al"})
+        for (int i : {20, 3, -7})
+            map.insert(encodeKey(user, i), std::string(user) + ":" + std::to_string(i));
+
+    std::vector<std::string> values;
+    map.scanPrefix(encodeKey("al"), [&](const std::string&, const std::string& v) {
+        values.push_back(v);
+        return true;
+    });
+    REQUIRE(values == std::vector<std::string>{"al:-7", "al:3", "al:20"});
+
+    REQUIRE(prefixUpperBound("ab") == "ac");
+    REQUIRE(prefixUpperBound("a\xff") == "b");
+    REQUIRE_FALSE(prefixUpperBound("\xff").has_value());
+}
+
+TEST_CASE("TreeMap pages through entries with continuation tokens") {
+    TreeMap map(KeyOrder::Natural);
+    for (int i = 0; i < 25; ++i)
+        map.insert("key_" + std::to_string(i), std::to_string(i));
+
+    std::vector<std::string> seen;
+    ScanPage page = map.scanPage("", 10);
+    for (const auto& [k, v] : page.entries)
+        seen.push_back(k);
+    REQUIRE(seen.size() == 10);
+    REQUIRE(seen.back() == "key_9");
+    REQUIRE_FALSE(page.done);
+
+    // Mutations between pages: the last returned key goes away, a key
+    // before the cursor and one after it appear
+    map.deleteKey("key_9");
+    map.insert("key_5a", "behind");
+    map.insert("key_10a", "ahead");
+
+    while (!page.done) {
+        page = map.scanPage(page.token, 10);
+        for (const auto& [k, v] : page.entries)
+            seen.push_back(k);
+    }
+    REQUIRE(seen.size() == 26);
+    REQUIRE(seen[10] == "key_10");
+    REQUIRE(seen[11] == "key_10a");
+    REQUIRE(seen.back() == "key_24");
+    REQUIRE(page.token.empty());
+
+    REQUIRE(map.scanPage("", 0).entries.empty());
+    REQUIRE_THROWS_AS(map.scanPage("garbage", 10), std::invalid_argument);
+}
+
+TEST_CASE("SplayTree works as a mergeable priority queue") {
+    using Deadline = std::pair<int, std::string>;   // (due, task)
+    SplayTree<Deadline> queue;
+    REQUIRE(queue.min() == nullptr);
+    REQUIRE_FALSE(queue.popMax().has_value());
+
+    for (int due : {50, 10, 40, 30, 20})
+        queue.insert({due, "task" + std::to_string(due)});
+
+    REQUIRE(queue.min()->first == 10);
+    REQUIRE(queue.max()->first == 50);
+    REQUIRE(queue.popMin()->second == "task10");
+    REQUIRE(queue.popMax()->first == 50);
+    REQUIRE(queue.erase({30, "task30"}));   // cancel by key
+    REQUIRE(queue.size() == 2);
+
+    SECTION("join of disjoint ranges links the trees") {
+        SplayTree<Deadline> later;
+        for (int due : {90, 70, 80})
+            later.insert({due, "late"});
+        queue.join(later);
+        REQUIRE(later.empty());
+        REQUIRE(queue.size() == 5);
+
+        std::vector<int> order;
+        while (auto d = queue.popMin())
+            order.push_back(d->first);
+        REQUIRE(order == std::vector<int>{20, 40, 70, 80, 90});
+    }
+
+    SECTION("join of overlapping trees from another arena") {
+        SplayTree<Deadline> other(ArenaMode::Pooled);
+        for (int due : {5, 25, 40})
+            other.insert({due, due == 40 ? "task40" : "other"});
+        queue.join(other);
+        REQUIRE(other.empty());
+        REQUIRE(queue.size() == 4);
+
+        std::vector<int> order;
+        while (auto d = queue.popMax())
+            order.push_back(d->first);
+        REQUIRE(order == std::vector<int>{40, 25, 20, 5});
+    }
+}
+
+TEST_CASE("SplayTree join keeps keys and values on overlap") {
+    // values too long for SSO, so a moved-from string would read back empty
+    auto longValue = [](const std::string& tag) { return tag + std::string(40, '.'); };
+
+    SplayTree<KeyValuePair> mine;
+    SplayTree<KeyValuePair> other(ArenaMode::Pooled);
+    for (const char* key : {"a", "c", "e"})
+        mine.insert(KeyValuePair(key, longValue(std::string("mine_") + key)));
+    for (const char* key : {"b", "c", "e", "f"})
+        other.insert(KeyValuePair(key, longValue(std::string("other_") + key)));
+
+    mine.join(other);
+    REQUIRE(other.empty());
+    REQUIRE(mine.size() == 5);
+
+    std::vector<std::string> seen;
+    for (auto* n = mine.first(); n; n = mine.successor(n))
+        seen.push_back(n->data.key + "=" + n->data.value);
+    REQUIRE(seen == std::vector<std::string>{
+        "a=" + longValue("mine_a"),
+        "b=" + longValue("other_b"),
+        "c=" + longValue("other_c"),   // other's entry wins on equal keys
+        "e=" + longValue("other_e"),
+        "f=" + longValue("other_f"),
+    });
+}
+
+TEST_CASE("IntervalMap answers stabbing and overlap queries") {
+    IntervalMap<std::uint32_t, std::string> ranges;
+    ranges.insert(0x0A000000, 0x0AFFFFFF, "10/8");
+    ranges.insert(0x0A010000, 0x0A01FFFF, "10.1/16");
+    ranges.insert(0xC0A80000, 0xC0A8FFFF, "192.168/16");
+    ranges.insert(0x0A010100, 0x0A0101FF, "10.1.1/24");
+
+    REQUIRE(ranges.stabbing(0x0A010105) == std::vector<std::string>{"10/8", "10.1/16", "10.1.1/24"});
+    REQUIRE(ranges.stabbing(0x0A020000) == std::vector<std::string>{"10/8"});
+    REQUIRE(ranges.stabbing(0x0B000000).empty());
+
+    ranges.insert(0x0A010000, 0x0A01FFFF, "renamed");
+    REQUIRE(ranges.size() == 4);
+    REQUIRE(*ranges.find(0x0A010000, 0x0A01FFFF) == "renamed");
+    REQUIRE(ranges.erase(0x0A000000, 0x0AFFFFFF));
+    REQUIRE(ranges.stabbing(0x0A010105) == std::vector<std::string>{"renamed", "10.1.1/24"});
+
+    SECTION("matches a linear scan") {
+        IntervalMap<int, int> windows;
+        std::vector<std::pair<int, int>> all;
+        std::uint32_t seed = 7;
+        auto next = [&] { return static_cast<int>((seed = seed * 1103515245u + 12345u) >> 16) % 1000; };
+        for (int i = 0; i < 400; ++i) {
+            int lo = next(), len = next() % 50;
+            windows.insert(lo, lo + len, i);
+            all.emplace_back(lo, lo + len);
+        }
+        // Erases exercise the augmentation fix-up outside rotations
+        std::vector<std::pair<int, int>> erased(all.begin(), all.begin() + 100);
+        for (const auto& [lo, hi] : erased)
+            windows.erase(lo, hi);
+        std::erase_if(all, [&](const auto& w) { return std::find(erased.begin(), erased.end(), w) != erased.end(); });
+        std::sort(all.begin(), all.end());
+        all.erase(std::unique(all.begin(), all.end()), all.end());
+        REQUIRE(windows.size() == all.size());
+
+        for (int q = 0; q < 200; ++q) {
+            int lo = next(), hi = lo + next() % 30;
+            std::size_t expected = 0;
+            for (const auto& [a, b] : all)
+                expected += (a <= hi && b >= lo);
+            std::size_t found = 0;
+            windows.overlapping(lo, hi, [&](int a, int b, int) {
+                REQUIRE((a <= hi && b >= lo));
+                ++found;
+                return true;
+            });
+            REQUIRE(found == expected);
+        }
+    }
+
+    SECTION("sorted inserts (a long path) are handled without recursion") {
+        IntervalMap<int, int> seq;
+        for (int i = 0; i < 200000; ++i)
+            seq.insert(i, i + 2, i);
+        REQUIRE(seq.stabbing(100000) == std::vector<int>{99998, 99999, 100000});
+    }
+}
+
+TEST_CASE("SplaySequence edits by position") {
+    SplaySequence<char> text;
+    for (char c : std::string("hello world"))
+        text.pushBack(c);
+    text.insertAt(5, ',');
+    REQUIRE(text.size() == 12);
+    REQUIRE(text.at(5) == ',');
+    REQUIRE(text.eraseAt(0) == 'h');
+    text.pushFront('H');
+
+    auto str = [](SplaySequence<char>& s) {
+        auto v = s.toVector();
+        return std::string(v.begin(), v.end());
+    };
+    REQUIRE(str(text) == "Hello, world");
+
+    text.reverse(7, 12);
+    REQUIRE(str(text) == "Hello, dlrow");
+
+    SplaySequence<char> tail = text.split(5);
+    REQUIRE(str(text) == "Hello");
+    REQUIRE(str(tail) == ", dlrow");
+    tail.concat(text);
+    REQUIRE(text.empty());
+    REQUIRE(str(tail) == ", dlrowHello");
+    REQUIRE_THROWS_AS(tail.at(12), std::out_of_range);
+
+    SECTION("matches a vector under random edits") {
+        SplaySequence<int> seq(ArenaMode::Pooled);
+        std::vector<int> model;
+        std::uint32_t seed = 11;
+        auto next = [&](std::size_t bound) { return ((seed = seed * 1103515245u + 12345u) >> 16) % (bound ? bound : 1); };
+
+        for (int step = 0; step < 3000; ++step) {
+            std::size_t op = next(4);
+            if (op == 0 || model.size() < 2) {
+                std::size_t pos = next(model.size() + 1);
+                seq.insertAt(pos, step);
+                model.insert(model.begin() + static_cast<std::ptrdiff_t>(pos), step);
+            } else if (op == 1) {
+                std::size_t pos = next(model.size());
+                REQUIRE(seq.eraseAt(pos) == model[pos]);
+                model.erase(model.begin() + static_cast<std::ptrdiff_t>(pos));
+            } else if (op == 2) {
+                std::size_t a = next(model.size()), b = next(model.size() + 1);
+                if (a > b) std::swap(a, b);
+                seq.reverse(a, b);
+                std::reverse(model.begin() + static_cast<std::ptrdiff_t>(a), model.begin() + static_cast<std::ptrdiff_t>(b));
+            } else {
+                std::size_t pos = next(model.size());
+                REQUIRE(seq.at(pos) == model[pos]);
+            }
+        }
+        REQUIRE(seq.toVector() == model);
+    }
+}
+
+TEST_CASE("TreeMap diffs against another map by range hashes") {
+    TreeMap a, b;
+    for (int i = 0; i < 2000; ++i)
+        a.insert("key_" + std::to_string(i), std::to_string(i));
+    for (int i = 1999; i >= 0; --i)   // same contents, different shape
+        b.insert("key_" + std::to_string(i), std::to_string(i));
+
+    REQUIRE(a.rangeDigest() == b.rangeDigest());
+    REQUIRE(a.rangeDigest().count == 2000);
+    REQUIRE(a.rangeDigest("key_1", "key_2") == b.rangeDigest("key_1", "key_2"));
+    REQUIRE(a.rangeDigest("key_1", "key_2").count == 1111);
+    REQUIRE(a.keyAtRank(0) == "key_0");
+    REQUIRE_FALSE(a.keyAtRank(2000).has_value());
+    REQUIRE(a.diff(b).empty());
+
+    // Mutations after hashing is on keep the digests current
+    a.insert("key_500", "changed");
+    a.deleteKey("key_1500");
+    b.insert("key_extra", "only in b");
+    a.get("key_77");   // splays; must not matter
+
+    std::vector<KeyDifference> d = a.diff(b);
+    REQUIRE(d.size() == 3);
+    REQUIRE(d[0].key == "key_1500");
+    REQUIRE_FALSE(d[0].mine.has_value());
+    REQUIRE(d[0].theirs == "1500");
+    REQUIRE(d[1].key == "key_500");
+    REQUIRE(d[1].mine == "changed");
+    REQUIRE(d[1].theirs == "500");
+    REQUIRE(d[2].key == "key_extra");
+    REQUIRE(d[2].theirs == "only in b");
+
+    SECTION("hashes cover the stored value, not its encoding") {
+        TreeMap packed;
+        packed.setValueCodec(std::make_shared<LzCodec>(), 8);
+        TreeMap plain;
+        for (int i = 0; i < 100; ++i) {
+            std::string value(64, static_cast<char>('a' + i % 26));
+            packed.insert("k" + std::to_string(i), value);
+            plain.insert("k" + std::to_string(i), value);
+        }
+        REQUIRE(packed.rangeDigest() == plain.rangeDigest());
+    }
+}
+
+TEST_CASE("TreeMap reports its hottest keys") {
+    TreeMap map;
+    REQUIRE(map.hotKeys().empty());
+    map.enableHotKeyTracking(16);
+
+    for (int i = 0; i < 1000; ++i)
+        map.insert("cold_" + std::to_string(i), "v");
+    for (int round = 0; round < 200; ++round) {
+        map.get("hot_a");
+        if (round % 2 == 0) map.get("hot_b");
+        map.insert("cold_" + std::to_string(round * 5), "v");
+    }
+
+    std::vector<HotKey> top = map.hotKeys(2);
+    REQUIRE(top.size() == 2);
+    REQUIRE(top[0].key == "hot_a");
+    REQUIRE(top[0].count >= 200);
+    REQUIRE(top[0].count - top[0].error <= 200);
+    REQUIRE(top[1].key == "hot_b");
+    REQUIRE(top[0].rate > 0);
+
+    SECTION("sampling scales counts back up") {
+        HotKeySketch sketch(8, 4);
+        for (int i = 0; i < 40000; ++i)
+            sketch.record(i % 2 ? "x" : "y" + std::to_string(i % 64));
+        std::vector<HotKey> hot = sketch.top(1);
+        REQUIRE(hot[0].key == "x");
+        REQUIRE(hot[0].count > 15000);
+        REQUIRE(hot[0].count < 25000 + hot[0].error);
+        REQUIRE(sketch.observed() == 40000);
+    }
+}
+
+TEST_CASE("Splay policy adapts to measured locality") {
+    auto makeKey = [](int i) {
+        return std::string("key_") + std::to_string(i);
+    };
+    TreeMap map;
+    for (int i = 0; i < 4096; ++i)
+        map.insert(makeKey(i), "v");
+
+    SECTION("static policies keep lookups correct") {
+        for (SplayPolicy p : {SplayPolicy::Semi, SplayPolicy::None, SplayPolicy::Full}) {
+            map.setSplayPolicy(p);
+            REQUIRE(map.activeSplayPolicy() == p);
+            for (int i = 0; i < 4096; i += 7)
+                REQUIRE(map.find(makeKey(i)).has_value());
+            map.insert(makeKey(1), "changed");
+            REQUIRE(map.get(makeKey(1)) == "changed");
+            REQUIRE(map.deleteKey(makeKey(2)));
+            map.insert(makeKey(2), "v");
+        }
+        map.rebalance();
+        REQUIRE(map.size() == 4096);
+    }
+
+    SECTION("uniform traffic stops splaying, skewed traffic resumes it") {
+        map.setSplayPolicy(SplayPolicy::Adaptive);
+        REQUIRE(map.activeSplayPolicy() == SplayPolicy::Full);
+
+        std::uint32_t seed = 3;
+        auto uniform = [&] { return static_cast<int>(((seed = seed * 1103515245u + 12345u) >> 8) % 4096); };
+        for (int i = 0; i < 200000; ++i)
+            map.get(makeKey(uniform()));
+        REQUIRE(map.activeSplayPolicy() == SplayPolicy::None);
+
+        for (int i = 0; i < 200000; ++i)
+            map.get(makeKey(i % 4));
+        REQUIRE(map.activeSplayPolicy() == SplayPolicy::Full);
+        REQUIRE(map.splayPolicy() == SplayPolicy::Adaptive);
+    }
+
+    SECTION("range hashes survive a rebalance") {
+        RangeDigest before = map.rangeDigest();
+        map.rebalance();
+        REQUIRE(map.rangeDigest() == before);
+    }
+}
+
+TEST_CASE("FlatCombiningTreeMap serves concurrent threads") {
+    TreeMap map;
+    FlatCombiningTreeMap shared(map);
+
+    constexpr int kThreads = 8;
+    constexpr int kPerThread = 2000;
+    std::atomic<int> mismatches{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < kPerThread; ++i) {
+                std::string key = "t" + std::to_string(t) + "_" + std::to_string(i);
+                shared.insert(key, std::to_string(i));
+                if (shared.get(key) != std::to_string(i))
+                    ++mismatches;
+                if (i % 2 && !shared.deleteKey(key))
+                    ++mismatches;
+            }
+        });
+    }
+    for (auto& th : threads)
+        th.join();
+
+    REQUIRE(mismatches == 0);
+    REQUIRE(shared.size() == kThreads * kPerThread / 2);
+    REQUIRE_FALSE(shared.find("t0_1").has_value());
+    REQUIRE(shared.get("t7_0") == "0");
+
+    FlatCombiningStats stats = shared.stats();
+    REQUIRE(stats.operations == kThreads * kPerThread * 5 / 2 + 3);
+    REQUIRE(stats.batches <= stats.operations);
+
+    SECTION("exceptions reach the calling thread") {
+        struct FailingCodec : ValueCodec {
+            std::string compress(std::string_view) const override {
+                throw std::runtime_error("codec failure");
+            }
+            std::string decompress(const std::string& packed) const override {
+                return packed;
+            }
+        };
+        TreeMap guarded;
+        guarded.setValueCodec(std::make_shared<FailingCodec>(), 0);
+        FlatCombiningTreeMap wrapper(guarded);
+        REQUIRE_THROWS_AS(wrapper.insert("k", "v"), std::runtime_error);
+        REQUIRE(wrapper.size() == 0);
+    }
+}
+
+TEST_CASE("ShardedTreeMap delegates to shard owners") {
+    ShardedTreeMap sharded(4);
+    REQUIRE(sharded.shardCount() == 4);
+
+    constexpr int kThreads = 6;
+    constexpr int kPerThread = 1500;
+    std::atomic<int> mismatches{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&, t] {
+            std::vector<std::future<void>> writes;
+            for (int i = 0; i < kPerThread; ++i)
+                writes.push_back(sharded.insert("t" + std::to_string(t) + "_" + std::to_string(i), std::to_string(i)));
+            for (auto& w : writes)
+                w.get();
+            for (int i = 0; i < kPerThread; ++i) {
+                std::string key = "t" + std::to_string(t) + "_" + std::to_string(i);
+                if (sharded.find(key).get() != std::to_string(i))
+                    ++mismatches;
+                if (i % 2 && !sharded.deleteKey(key).get())
+                    ++mismatches;
+            }
+        });
+    }
+    for (auto& th : threads)
+        th.join();
+
+    REQUIRE(mismatches == 0);
+    REQUIRE(sharded.size() == kThreads * kPerThread / 2);
+    REQUIRE_FALSE(sharded.find("t0_1").get().has_value());
+
+    // Operations from one thread on one key run in submission order
+    auto a = sharded.insert("same", "1");
+    auto b = sharded.insert("same", "2");
+    auto c = sharded.find("same");
+    a.get();
+    b.get();
+    REQUIRE(c.get() == "2");
+
+    std::string shardKey = "t3_0";
+    std::size_t shard = sharded.shardFor(shardKey);
+    auto owned = sharded.submit(shardKey, [](TreeMap& m) { return m.find("t3_0").has_value(); });
+    REQUIRE(owned.get());
+    REQUIRE(sharded.submitTo(shard, [](TreeMap& m) { return m.size(); }).get() > 0);
+
+    std::promise<std::string> seen;
+    sharded.post("t5_4", [&](TreeMap& m) { seen.set_value(m.get("t5_4")); });
+    REQUIRE(seen.get_future().get() == "4");
+
+    auto failed = sharded.submit("k", [](TreeMap&) -> int { throw std::runtime_error("boom"); });
+    REQUIRE_THROWS_AS(failed.get(), std::runtime_error);
+
+    ShardedStats stats = sharded.stats();
+    REQUIRE(stats.operations >= kThreads * kPerThread * 5 / 2);
+    REQUIRE(stats.batches <= stats.operations);
+    REQUIRE(stats.largestBatch <= ShardedTreeMap::kBatch);
+}
+
 // ------------------------------------------------------
 // Benchmarks (no nesting, same style as factorial example)
 // ------------------------------------------------------